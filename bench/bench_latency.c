@@ -0,0 +1,285 @@
+/*
+ * Measures the time from a HID report coming in to its key presses
+ * being written to uinput and its MMC commands being handed to the ALSA
+ * sequencer. Reports go through the same decoder and output thread as
+ * in `komplement`, only the keyboard is replaced by made-up reports (or
+ * a recording) and uinput by /dev/null (unless -o is given).
+ *
+ * Build and run it with `make bench-latency`.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "dispatch.h"
+#include "config.h"
+#include "alsa.h"
+#include "uinput_stuff.h"
+#include "capture.h"
+#include "event_loop.h"
+#include "latency.h"
+
+#define DEFAULT_MAPPING_PATH    "mappings/rosegarden.map"
+#define DEFAULT_REPORTS         100000
+
+static mapping_t mapping;
+static action_table_t * actions;
+static dispatch_t dispatch;
+
+
+static void print_usage( char * argv0 )
+{
+    printf(
+        "Usage: %s <options>\n\n"
+        "Options:\n"
+        " -m /path/to/mapping  The mapping to use (" DEFAULT_MAPPING_PATH ").\n"
+        " -c <count>           The number of reports to make up (%d).\n"
+        " -r <file>            Replay the reports in <file> instead.\n"
+        " -o /path/to/uinput   Send the keys to uinput instead of /dev/null.\n"
+        " -a                   Do not send MMC and MIDI messages to ALSA.\n",
+        argv0,
+        DEFAULT_REPORTS );
+}
+
+
+static void no_leds( int device, int layer )
+{
+}
+
+
+/*
+ * Drops all MMC commands and MIDI messages from the mappings, for when
+ * there is no ALSA sequencer to send them to.
+ */
+static void strip_mmc()
+{
+    for(int button=0; button<REAL_BUTTON_TOTAL; button++)
+    {
+        for(int layer=0; layer<MAPPING_LAYERS; layer++)
+        {
+            mapping_key_t key = *mapping_get( &mapping, layer, button );
+            int length = 0;
+
+            for(int i=0; i<key.length; i++)
+            {
+                if (key.keys[i].type != MAPPING_TYPE_MMC
+                    && key.keys[i].type != MAPPING_TYPE_CC
+                    && key.keys[i].type != MAPPING_TYPE_NOTE
+                    && key.keys[i].type != MAPPING_TYPE_PC)
+                {
+                    key.keys[ length++ ] = key.keys[i];
+                }
+            }
+
+            key.length = length;
+            mapping_set( &mapping, layer, button, key );
+        }
+    }
+}
+
+
+/*
+ * Hands a report to the decoder, and waits for the output thread to
+ * pick up what it queued so every report is measured on its own.
+ */
+static void bench_report( const unsigned char * report, int length )
+{
+    if (length < DISPATCH_REPORT_MIN_SZ) return;
+
+    dispatch_report( &dispatch, report, length, evloop_now() );
+    output_wait_idle();
+}
+
+
+/*
+ * Presses and releases every mapped button in turn (some of them with
+ * SHIFT held), and turns the dial in between.
+ */
+static void bench_made_up( int count )
+{
+    unsigned char report[ DECODER_REPORT_SZ ];
+    int buttons[ TOGGLE_BUTTON_TOTAL ];
+    int total = 0;
+
+    for(int button=1; button<TOGGLE_BUTTON_TOTAL; button++)
+    {
+        if (mapping_is_mapped( &mapping, button, -1 ))
+        {
+            buttons[ total++ ] = button;
+        }
+    }
+
+    memset( report, 0, sizeof report );
+    report[ 0 ] = 0x01;
+
+    for(int i=0; i<count; i++)
+    {
+        const int button = total ? buttons[ (i / 2) % total ] : 0;
+        const int shifted = (i / (2 * (total ? total : 1))) % 4 == 3;
+
+        if (i % 2 == 0)
+        {
+            decoder_encode( report, 0, shifted );
+            decoder_encode( report, button, 1 );
+
+            // Every so often, one detent of the dial.
+            if (i % 8 == 0)
+            {
+                report[ DECODER_DIAL_BYTE ] = (report[ DECODER_DIAL_BYTE ] + (i % 16 ? 1 : DIAL_POSITIONS - 1)) % DIAL_POSITIONS;
+            }
+        }
+        else
+        {
+            decoder_encode( report, button, 0 );
+            decoder_encode( report, 0, 0 );
+        }
+
+        bench_report( report, sizeof report );
+    }
+}
+
+
+/*
+ * Pushes all reports of a recording through, as fast as possible.
+ *
+ * Returns -1 on error, the number of reports otherwise.
+ */
+static int bench_recording( const char * path )
+{
+    unsigned char report[ HID_REPORT_MAX ];
+    capture_t replay;
+    uint64_t timestamp;
+    int length, count = 0;
+
+    if (capture_open( &replay, path, 0 ) < 0)
+    {
+        printf( "The recording `%s` could not be read.\n", path );
+        return -1;
+    }
+
+    while ((length = capture_read( &replay, &timestamp, report, sizeof report )) > 0)
+    {
+        bench_report( report, length );
+        count++;
+    }
+
+    capture_close( &replay );
+
+    if (length < 0)
+    {
+        printf( "The recording `%s` is damaged.\n", path );
+        return -1;
+    }
+
+    return count;
+}
+
+
+int main( int argc, char * argv[] )
+{
+    char * mapping_path = DEFAULT_MAPPING_PATH;
+    char * replay_path = NULL;
+    char * uinput_path = NULL;
+    int count = DEFAULT_REPORTS;
+    int use_alsa = 1;
+    int fd_uinput = -1;
+    int opt;
+
+    while ((opt = getopt( argc, argv, "m:c:r:o:ah" )) != -1)
+    {
+        switch (opt)
+        {
+            case 'm': mapping_path = optarg; break;
+            case 'c': count = atoi( optarg ); break;
+            case 'r': replay_path = optarg; break;
+            case 'o': uinput_path = optarg; break;
+            case 'a': use_alsa = 0; break;
+
+            default:
+                print_usage( argv[0] );
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    mapping_init( &mapping );
+    if (config_read( &mapping, mapping_path, 0 ) < 0)
+    {
+        printf( "The mapping file `%s` could not be read.\n", mapping_path );
+        return 2;
+    }
+
+    if (use_alsa && alsa_open_client( NULL ) < 0)
+    {
+        printf( "No ALSA sequencer, MMC latency is not measured.\n" );
+        use_alsa = 0;
+    }
+
+    if (!use_alsa) strip_mmc();
+
+    fd_uinput = uinput_path
+        ? uinput_open( uinput_path )
+        : open( "/dev/null", O_WRONLY );
+
+    if (fd_uinput < 0)
+    {
+        perror( uinput_path ? uinput_path : "/dev/null" );
+        alsa_close_client();
+        return 3;
+    }
+
+    actions = action_compile( &mapping );
+    if (!actions)
+    {
+        printf( "The mapping could not be compiled.\n" );
+        alsa_close_client();
+        return 3;
+    }
+
+    dispatch_init( &dispatch, 0, actions );
+    latency_reset();
+
+    // The wheels aren't measured, their events are dropped.
+    if (output_start( fd_uinput, -1, no_leds ) < 0)
+    {
+        printf( "The output thread could not be started.\n" );
+        return 3;
+    }
+
+    const uint64_t started = evloop_now();
+
+    if (replay_path)
+    {
+        count = bench_recording( replay_path );
+    }
+    else
+    {
+        bench_made_up( count );
+    }
+
+    output_stop();
+
+    const double seconds = (evloop_now() - started) / 1e9;
+
+    if (count >= 0)
+    {
+        printf( "%d reports in %.2f s.\n\n", count, seconds );
+        latency_print( LATENCY_UINPUT, "HID report to uinput write()" );
+
+        if (use_alsa)
+        {
+            printf( "\n" );
+            latency_print( LATENCY_ALSA, "HID report to snd_seq_drain_output()" );
+        }
+    }
+
+    alsa_close_client();
+    action_free( actions );
+
+    if (uinput_path) uinput_close( fd_uinput );
+    else close( fd_uinput );
+
+    return count < 0 ? 4 : 0;
+}
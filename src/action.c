@@ -0,0 +1,165 @@
+#include "action.h"
+
+// Returned for buttons that don't exist, it does nothing.
+static const action_t null_action;
+
+
+static void action_add_key( action_t * action, int code )
+{
+    struct input_event * press = &action->press[ action->key_count ];
+    struct input_event * release = &action->release[ action->key_count ];
+
+    press->type = release->type = EV_KEY;
+    press->code = release->code = code;
+    press->value = 1;
+    release->value = 0;
+
+    action->key_count++;
+}
+
+
+static void action_add_midi( action_midi_t * midi, int status, int data1, int data2 )
+{
+    midi->status = status;
+    midi->data[0] = data1;
+    midi->data[1] = data2;
+}
+
+
+/*
+ * Encodes everything `key` sends.
+ */
+static void action_compile_key( action_t * action, const mapping_key_t * key )
+{
+    action->mapped = key->length > 0;
+    dial_accel_compile( &action->accel, key );
+    action->mmc_device = key->mmc_device;
+    action->rel_scale = key->scale != 0 ? key->scale : MAPPING_REL_SCALE;
+    action->toggle = key->toggle;
+    action->repeat_delay = key->repeat_delay;
+    action->repeat_rate = key->repeat_rate;
+    action->layer_key = mapping_layer_key( key ) > 0 ? mapping_layer_key( key ) : MAPPING_LAYER_NONE;
+    action->latch = key->latch;
+
+    for(int i=0; i<key->length; i++)
+    {
+        const int code = key->keys[i].key;
+        const int channel = MIDI_CHANNEL( code );
+
+        switch (key->keys[i].type)
+        {
+            case MAPPING_TYPE_KEY:
+                action_add_key( action, code );
+                break;
+
+            case MAPPING_TYPE_MMC:
+                action->mmc[ action->mmc_count++ ] = code;
+                break;
+
+            case MAPPING_TYPE_REL:
+                action->rel[ action->rel_count++ ] = code;
+                break;
+
+            // A CC goes to its value and back to 0, unless it toggles.
+            case MAPPING_TYPE_CC:
+                if (key->toggle)
+                {
+                    action->toggle_cc[ action->toggle_count++ ] = code;
+                    break;
+                }
+
+                action_add_midi( &action->midi_press[ action->midi_press_count++ ],
+                    MIDI_STATUS_CC | channel, MIDI_NUMBER( code ), MIDI_VALUE( code ) );
+                action_add_midi( &action->midi_release[ action->midi_release_count++ ],
+                    MIDI_STATUS_CC | channel, MIDI_NUMBER( code ), 0 );
+                break;
+
+            case MAPPING_TYPE_NOTE:
+                action_add_midi( &action->midi_press[ action->midi_press_count++ ],
+                    MIDI_STATUS_NOTE_ON | channel, MIDI_NUMBER( code ), MIDI_VALUE( code ) );
+                action_add_midi( &action->midi_release[ action->midi_release_count++ ],
+                    MIDI_STATUS_NOTE_OFF | channel, MIDI_NUMBER( code ), 0 );
+                break;
+
+            case MAPPING_TYPE_PC:
+                action_add_midi( &action->midi_press[ action->midi_press_count++ ],
+                    MIDI_STATUS_PC | channel, MIDI_NUMBER( code ), 0 );
+                break;
+        }
+    }
+}
+
+
+/*
+ * Compiles the actions of every button in `mapping`.
+ *
+ * Returns NULL if there is no memory for them, the table otherwise
+ * (free it with `action_free()`).
+ */
+action_table_t * action_compile( const mapping_t * mapping )
+{
+    action_table_t * table = aligned_alloc( ACTION_ALIGN, sizeof(action_table_t) );
+    if (!table) return NULL;
+
+    memset( table, 0, sizeof(action_table_t) );
+
+    for(int layer=0; layer<ACTION_LAYERS; layer++)
+    {
+        for(int button=0; button<REAL_BUTTON_TOTAL; button++)
+        {
+            action_t * action = &table->actions[ layer ][ button ];
+            const mapping_key_t * key = mapping_get( mapping, layer, button );
+
+            // A layer button keeps working on the other layers where
+            // it isn't mapped, so they can be switched between (or
+            // latched off again).
+            if (key->length == 0 && mapping_layer_key( mapping_get( mapping, MAPPING_LAYER_NONE, button ) ) > -1)
+            {
+                key = mapping_get( mapping, MAPPING_LAYER_NONE, button );
+            }
+
+            action_compile_key( action, key );
+        }
+
+        // The SHIFT button always is the momentary SHIFT layer.
+        action_t * shift = &table->actions[ layer ][ 0 ];
+        memset( shift, 0, sizeof(action_t) );
+        shift->layer_key = MAPPING_LAYER_SHIFT;
+    }
+
+    return table;
+}
+
+
+void action_free( action_table_t * table )
+{
+    free( table );
+}
+
+
+/*
+ * Returns the action of `button` on `layer`, which does nothing if
+ * there is no such button.
+ */
+const action_t * action_get( const action_table_t * table, int layer, int button )
+{
+    if (layer < 0 || layer >= ACTION_LAYERS || button < 0 || button >= REAL_BUTTON_TOTAL)
+    {
+        return &null_action;
+    }
+
+    return &table->actions[ layer ][ button ];
+}
+
+
+/*
+ * @returns 1 if a press or release of `action` doesn't send anything
+ * (apart from wheel movements), 0 otherwise.
+ */
+int action_is_empty( const action_t * action )
+{
+    return action->key_count == 0
+        && action->mmc_count == 0
+        && action->midi_press_count == 0
+        && action->midi_release_count == 0;
+}
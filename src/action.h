@@ -0,0 +1,90 @@
+#ifndef _ACTION_H_
+#define _ACTION_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/uinput.h>
+
+#include "mapping.h"
+#include "midi_stuff.h"
+#include "dial.h"
+
+// The layers of buttons, one for every layer of the mapping.
+#define ACTION_LAYERS       MAPPING_LAYERS
+
+// Every action starts on a cache line of its own.
+#define ACTION_ALIGN        64
+
+/*
+ * A MIDI channel message as it goes out: the status byte (with the
+ * channel) and its data bytes.
+ */
+typedef struct action_midi_t {
+    unsigned char status;
+    unsigned char data[ 2 ];
+} action_midi_t;
+
+/*
+ * What a button does, compiled from its mapping when it is loaded so a
+ * press or release doesn't have to look at the mapping at all. The
+ * parts that are needed for every press come first.
+ */
+typedef struct action_t {
+    // The key events of a press and of its release.
+    unsigned char key_count;
+    struct input_event press[ MAX_KEYS ];
+    struct input_event release[ MAX_KEYS ];
+
+    // The MMC commands of a press, for `mmc_device`.
+    unsigned char mmc_count;
+    unsigned char mmc_device;
+    unsigned char mmc[ MAX_KEYS ];
+
+    // The MIDI messages of a press and of its release. The CCs of a
+    // `toggle` mapping aren't in here, they depend on its state.
+    unsigned char midi_press_count;
+    unsigned char midi_release_count;
+    action_midi_t midi_press[ MAX_KEYS ];
+    action_midi_t midi_release[ MAX_KEYS ];
+
+    // The wheels it moves, by `rel_scale` per detent.
+    unsigned char rel_count;
+    unsigned short rel[ MAX_KEYS ];
+    int rel_scale;
+
+    // The CCs a `toggle` mapping switches on and off, packed like the
+    // mapping has them.
+    int toggle;
+    unsigned char toggle_count;
+    int toggle_cc[ MAX_KEYS ];
+
+    int repeat_delay;
+    int repeat_rate;
+
+    // The layer this button switches to while it is held (or until it
+    // is pressed again if it latches), MAPPING_LAYER_NONE if it doesn't.
+    int layer_key;
+    int latch;
+
+    // Anything is mapped to the button at all, and how it accelerates
+    // when it is the dial.
+    int mapped;
+    dial_accel_t accel;
+} __attribute__((aligned( ACTION_ALIGN ))) action_t;
+
+/*
+ * All the actions of a keyboard, in one block.
+ */
+typedef struct action_table_t {
+    action_t actions[ ACTION_LAYERS ][ REAL_BUTTON_TOTAL ];
+} action_table_t;
+
+action_table_t * action_compile( const mapping_t * mapping );
+void action_free( action_table_t * table );
+
+const action_t * action_get( const action_table_t * table, int layer, int button );
+int action_is_empty( const action_t * action );
+
+#endif /* _ACTION_H_ */
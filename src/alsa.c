@@ -1,9 +1,38 @@
 #include "alsa.h"
 
-// The handle to the output port.
+// The handle to the output port (and the input port).
 static snd_seq_t * handle = NULL;
+
+// The output thread writes to the handle while the event loop reads
+// from it, which alsa-lib doesn't make safe, so both hold this while
+// they use it. Opening and closing it is done while only one does.
+static pthread_mutex_t handle_lock = PTHREAD_MUTEX_INITIALIZER;
 static int output_port = -1;
 
+// Every MMC message, for every device ID, is built once when the port
+// is created. Sending one is then only a matter of queueing it.
+static unsigned char mmc_sysex[ MMC_DEVICES ][ MMC_COMMANDS ][ MMC_SYSEX_SZ ];
+static snd_seq_event_t mmc_events[ MMC_DEVICES ][ MMC_COMMANDS ];
+
+// The events that are waiting for `alsa_flush()`.
+static int queued = 0;
+
+// The input port, where the software tells us what it is doing. It is
+// read on the event loop, while the output port is written on the
+// output thread.
+static int input_port = -1;
+static int input_fds[ ALSA_MAX_POLL_FDS ];
+static int input_fd_count = 0;
+static alsa_input_t input_handler = NULL;
+static void * input_data = NULL;
+
+// With `alsa_start_queue()` the events are scheduled on this queue at
+// the time of their report plus `queue_offset`, rather than sent right
+// away. The queue started at `queue_start` (CLOCK_MONOTONIC).
+static int queue = -1;
+static uint64_t queue_start = 0;
+static uint64_t queue_offset = 0;
+
 /*
  * Creates the output port.
  */
@@ -17,6 +46,42 @@ int alsa_create_output_port()
     );
 }
 
+/*
+ * Creates the input port.
+ */
+static int alsa_create_input_port()
+{
+    return snd_seq_create_simple_port(
+        handle,
+        ALSA_CLIENT_NAME " " ALSA_INPUT_PORT_NAME,
+        SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE,
+        SND_SEQ_PORT_TYPE_APPLICATION
+    );
+}
+
+/*
+ * Builds the MMC events for the output port.
+ */
+static void alsa_prepare_mmc()
+{
+    for(int device=0; device<MMC_DEVICES; device++)
+    {
+        for(int command=0; command<MMC_COMMANDS; command++)
+        {
+            snd_seq_event_t * ev = &mmc_events[ device ][ command ];
+
+            mmc_encode( mmc_sysex[ device ][ command ], device, command );
+
+            snd_seq_ev_clear( ev );
+            snd_seq_ev_set_subs( ev );
+            snd_seq_ev_set_direct( ev );
+            snd_seq_ev_set_source( ev, output_port );
+            snd_seq_ev_set_sysex( ev, MMC_SYSEX_SZ, mmc_sysex[ device ][ command ] );
+        }
+    }
+}
+
+
 /* 
  * Create ALSA client and initialises the output port. 
  */
@@ -32,10 +97,48 @@ int alsa_open_client(char * client_name)
  
     // set up output port.
     output_port = alsa_create_output_port();
+    if (output_port >= 0) alsa_prepare_mmc();
+
+    // Without it the buttons are only lit up by what is mapped.
+    if (output_port >= 0)
+    {
+        input_port = alsa_create_input_port();
+        if (input_port < 0) printf( "The ALSA input port could not be created.\n" );
+    }
+
     return output_port;
 }
 
 
+/*
+ * Starts a queue the events are scheduled on, `offset_millis` after the
+ * report that caused them came in. Whatever delays them on the way, from
+ * the scheduler or the syscalls, then no longer shows up in their timing
+ * (as long as it is less than the offset).
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int alsa_start_queue( int offset_millis )
+{
+    if (!handle || offset_millis < 0 || offset_millis > ALSA_QUEUE_MAX_OFFSET) return -1;
+
+    queue = snd_seq_alloc_named_queue( handle, ALSA_QUEUE_NAME );
+    if (queue < 0) return -1;
+
+    if (snd_seq_start_queue( handle, queue, NULL ) < 0
+        || snd_seq_drain_output( handle ) < 0)
+    {
+        snd_seq_free_queue( handle, queue );
+        queue = -1;
+        return -1;
+    }
+
+    queue_start = evloop_now();
+    queue_offset = offset_millis * 1000000ULL;
+    return 0;
+}
+
+
 /* 
  * Cleanup ALSA client 
  */
@@ -43,21 +146,68 @@ void alsa_close_client()
 {
     if (handle != NULL)
     {
+        // The events that are still scheduled would be dropped.
+        if (queue >= 0)
+        {
+            snd_seq_sync_output_queue( handle );
+            snd_seq_free_queue( handle, queue );
+        }
+
         snd_seq_close( handle );
         handle = NULL;
     }
     
     output_port = -1;
+    input_port = -1;
+    queue = -1;
+    queued = 0;
 }
 
 
 
 /*
- * Sends the MMC message in `command` down the wire.
+ * Queues `ev` for the next `alsa_flush()`, on the queue if there is one.
+ */
+static int alsa_output( const snd_seq_event_t * ev, uint64_t timestamp )
+{
+    snd_seq_event_t scheduled;
+
+    if (queue >= 0)
+    {
+        // Relative to the start of the queue, where an event that is
+        // already late goes out right away.
+        uint64_t time = timestamp + queue_offset;
+        time = time > queue_start ? time - queue_start : 0;
+
+        const snd_seq_real_time_t real_time = {
+            .tv_sec = time / 1000000000ULL,
+            .tv_nsec = time % 1000000000ULL
+        };
+
+        scheduled = *ev;
+        snd_seq_ev_schedule_real( &scheduled, queue, 0, &real_time );
+        ev = &scheduled;
+    }
+
+    pthread_mutex_lock( &handle_lock );
+    const int result = snd_seq_event_output( handle, (snd_seq_event_t *)ev );
+    pthread_mutex_unlock( &handle_lock );
+
+    if (result < 0) return result;
+
+    queued++;
+    return 0;
+}
+
+
+/*
+ * Queues the MMC message in `command` for `device` (MMC_DEVICE_ALL for
+ * all of them), it is sent with the next `alsa_flush()`. The `timestamp`
+ * is the CLOCK_MONOTONIC time of the report it is for.
  * 
  * Returns negative values on error, 0 otherwise.
  */
-int alsa_send_mmc( unsigned char command, unsigned char channel )
+int alsa_queue_mmc( unsigned char command, unsigned char device, uint64_t timestamp )
 {
     if (!handle || output_port == -1)
     {
@@ -65,35 +215,216 @@ int alsa_send_mmc( unsigned char command, unsigned char channel )
         return -1;
     }
 
-    // from https://en.wikipedia.org/wiki/MIDI_Machine_Control
-    //
-    // F0 7F <Device-ID> <Sub-ID#1> [<Sub-ID#2> [<parameters>]] F7
-    //
-    // where Device-ID is:
-    // MMC device's ID#; value 00-7F (7F = all devices); AKA "channel number"
-    
-    // So this becomes the default buffer, where we change
-    // the 5th byte (index 4) for the command.
-    //
-    // Right now, we're ignoring the channel parameter, 
-    // so the "Device-ID" remains 0x7f.
-    unsigned char mmc_buffer[] = "\xf0\x7f\x7f\x06\x00\xf7";
-    mmc_buffer[ 4 ] = command;
-    
+    if (command >= MMC_COMMANDS || device >= MMC_DEVICES) return -1;
+
     // printf( "Send MMC command %02x\n", command );
-    
-    // Now we have an MMC message to send to the output port.
+
+    return alsa_output( &mmc_events[ device ][ command ], timestamp );
+}
+
+
+/*
+ * Queues a channel message, which is sent like the MMC commands.
+ */
+static int alsa_queue_event( snd_seq_event_t * ev, uint64_t timestamp )
+{
+    if (!handle || output_port == -1)
+    {
+        printf( "ALSA not initialised.\n" );
+        return -1;
+    }
+
+    snd_seq_ev_set_subs( ev );
+    snd_seq_ev_set_direct( ev );
+    snd_seq_ev_set_source( ev, output_port );
+
+    return alsa_output( ev, timestamp );
+}
+
+
+/*
+ * Queues a control change of `controller` to `value` on `channel` (0..15).
+ *
+ * Returns negative values on error, 0 otherwise.
+ */
+int alsa_queue_cc( unsigned char channel, unsigned char controller, unsigned char value, uint64_t timestamp )
+{
     snd_seq_event_t ev;
-    snd_seq_ev_clear(&ev);
 
-    snd_seq_ev_set_subs(&ev);
-    snd_seq_ev_set_direct(&ev);
-    snd_seq_ev_set_source(&ev, output_port );
+    snd_seq_ev_clear( &ev );
+    snd_seq_ev_set_controller( &ev, channel, controller, value );
+    return alsa_queue_event( &ev, timestamp );
+}
 
-    // Just set SYSEX stuff and send it out..
-    ev.type = SND_SEQ_EVENT_SYSEX;
-    
-    snd_seq_ev_set_sysex(&ev, 6, mmc_buffer);
-    return snd_seq_event_output_direct( handle, &ev );
+
+/*
+ * Queues a note on of `note` on `channel` (0..15), or a note off when
+ * `velocity` is 0.
+ *
+ * Returns negative values on error, 0 otherwise.
+ */
+int alsa_queue_note( unsigned char channel, unsigned char note, unsigned char velocity, uint64_t timestamp )
+{
+    snd_seq_event_t ev;
+
+    snd_seq_ev_clear( &ev );
+    if (velocity > 0) snd_seq_ev_set_noteon( &ev, channel, note, velocity );
+    else snd_seq_ev_set_noteoff( &ev, channel, note, 0 );
+    return alsa_queue_event( &ev, timestamp );
+}
+
+
+/*
+ * Queues a program change to `program` on `channel` (0..15).
+ *
+ * Returns negative values on error, 0 otherwise.
+ */
+int alsa_queue_pc( unsigned char channel, unsigned char program, uint64_t timestamp )
+{
+    snd_seq_event_t ev;
+
+    snd_seq_ev_clear( &ev );
+    snd_seq_ev_set_pgmchange( &ev, channel, program );
+    return alsa_queue_event( &ev, timestamp );
+}
+
+
+/*
+ * Sends everything that was queued, all at once.
+ * 
+ * Returns negative values on error, 0 otherwise.
+ */
+int alsa_flush()
+{
+    if (queued == 0) return 0;
+
+    pthread_mutex_lock( &handle_lock );
+    const int result = snd_seq_drain_output( handle );
+    pthread_mutex_unlock( &handle_lock );
+
+    queued = 0;
+
+    LATENCY_END( LATENCY_ALSA );
+    return result < 0 ? result : 0;
+}
+
+
+/*
+ * Turns an incoming event into the message it is about.
+ *
+ * Returns -1 if it is nothing we know, 0 otherwise.
+ */
+static int alsa_decode( const snd_seq_event_t * ev, mapped_key_t * message )
+{
+    int command;
+
+    switch (ev->type)
+    {
+        case SND_SEQ_EVENT_CONTROLLER:
+            *message = MAP_MIDI( MAPPING_TYPE_CC, MIDI_PACK( ev->data.control.channel & 0x0f,
+                ev->data.control.param & 0x7f, ev->data.control.value & 0x7f ) );
+            return 0;
+
+        case SND_SEQ_EVENT_NOTEON:
+        case SND_SEQ_EVENT_NOTEOFF:
+            *message = MAP_MIDI( MAPPING_TYPE_NOTE, MIDI_PACK( ev->data.note.channel & 0x0f,
+                ev->data.note.note & 0x7f,
+                ev->type == SND_SEQ_EVENT_NOTEON ? ev->data.note.velocity & 0x7f : 0 ) );
+            return 0;
+
+        case SND_SEQ_EVENT_PGMCHANGE:
+            *message = MAP_MIDI( MAPPING_TYPE_PC, MIDI_PACK( ev->data.control.channel & 0x0f,
+                ev->data.control.value & 0x7f, 0 ) );
+            return 0;
+
+        case SND_SEQ_EVENT_SYSEX:
+            command = mmc_decode( ev->data.ext.ptr, ev->data.ext.len );
+            if (command < 0) return -1;
+
+            *message = MAP_MMC_KEY( command );
+            return 0;
+    }
+
+    return -1;
+}
+
+
+static void alsa_on_readable( int fd, unsigned int events, void * data )
+{
+    snd_seq_event_t * ev;
+    mapped_key_t message;
+    int decoded, pending;
+
+    if (!handle) return;
+
+    // The first one is there, the others only if alsa-lib already has
+    // them, as asking the sequencer for more would block. The handler
+    // is called without the lock, it flushes the output thread.
+    do
+    {
+        pthread_mutex_lock( &handle_lock );
+
+        if (snd_seq_event_input( handle, &ev ) < 0)
+        {
+            pthread_mutex_unlock( &handle_lock );
+            return;
+        }
+
+        decoded = alsa_decode( ev, &message ) == 0;
+        pending = snd_seq_event_input_pending( handle, 0 ) > 0;
+
+        pthread_mutex_unlock( &handle_lock );
+
+        if (decoded) input_handler( message, input_data );
+    }
+    while (pending);
 }
 
+
+/*
+ * Hands what comes in on the input port to `handler`, from `loop`.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int alsa_watch( evloop_t * loop, alsa_input_t handler, void * data )
+{
+    struct pollfd fds[ ALSA_MAX_POLL_FDS ];
+
+    if (!handle || input_port < 0) return -1;
+
+    int count = snd_seq_poll_descriptors_count( handle, POLLIN );
+    if (count > ALSA_MAX_POLL_FDS) count = ALSA_MAX_POLL_FDS;
+
+    count = snd_seq_poll_descriptors( handle, fds, count, POLLIN );
+    if (count <= 0) return -1;
+
+    input_handler = handler;
+    input_data = data;
+
+    for(int i=0; i<count; i++)
+    {
+        if (evloop_add( loop, fds[i].fd, EPOLLIN, alsa_on_readable, NULL ) < 0)
+        {
+            alsa_unwatch( loop );
+            return -1;
+        }
+
+        input_fds[ input_fd_count++ ] = fds[i].fd;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Takes the input port out of `loop` again.
+ */
+void alsa_unwatch( evloop_t * loop )
+{
+    for(int i=0; i<input_fd_count; i++)
+    {
+        evloop_remove( loop, input_fds[i] );
+    }
+
+    input_fd_count = 0;
+}
@@ -3,18 +3,48 @@
 
 #include "version.h"
 #include "defs.h"
+#include "latency.h"
+#include "mmc_stuff.h"
+#include "mapping.h"
+#include "event_loop.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <alsa/asoundlib.h>
 
 #define ALSA_CLIENT_NAME      "KOMPLEMENTARY"
 #define ALSA_PORT_NAME        "MIDI OUT"
+#define ALSA_INPUT_PORT_NAME  "MIDI IN"
+#define ALSA_QUEUE_NAME       "KOMPLEMENTARY QUEUE"
+
+// The largest offset the queue can add to the report time.
+#define ALSA_QUEUE_MAX_OFFSET 1000
+
+// The most poll descriptors the input port is watched with.
+#define ALSA_MAX_POLL_FDS     4
+
+/*
+ * Called for every message that comes in on the input port, as an MMC
+ * command or a MIDI message like the ones a mapping sends (a note off
+ * being a note with velocity 0, a program change having value 0).
+ */
+typedef void (*alsa_input_t)( mapped_key_t message, void * data );
 
 int alsa_open_client( char * client_name );
-int alsa_send_mmc( unsigned char command, unsigned char channel );
+int alsa_start_queue( int offset_millis );
+
+int alsa_queue_mmc( unsigned char command, unsigned char device, uint64_t timestamp );
+int alsa_queue_cc( unsigned char channel, unsigned char controller, unsigned char value, uint64_t timestamp );
+int alsa_queue_note( unsigned char channel, unsigned char note, unsigned char velocity, uint64_t timestamp );
+int alsa_queue_pc( unsigned char channel, unsigned char program, uint64_t timestamp );
+int alsa_flush();
+
+int alsa_watch( evloop_t * loop, alsa_input_t handler, void * data );
+void alsa_unwatch( evloop_t * loop );
 
 void alsa_close_client();
 
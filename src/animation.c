@@ -0,0 +1,434 @@
+#include "animation.h"
+
+/*
+ * Plays the LED animations from a timer on an event loop, rather than
+ * sleeping in between the frames, so nothing else has to wait for them.
+ * An animation draws on top of what the LEDs are set to (see
+ * `leds_overlay()`), which is what they show again once it is over.
+ */
+
+static animation_t animations[ ANIMATION_COUNT ];
+static animation_playing_t playing[ ANIMATION_MAX_PLAYING ];
+
+static evloop_t * animation_loop = NULL;
+static int timer = -1;
+
+// No more than one frame is drawn every `frame_ns`, keyframes that are
+// closer together are shown in the same frame.
+static uint64_t frame_ns = 0;
+static uint64_t drawn = 0;
+
+// Set by `animation_finish()`, the loop is stopped once the last of the
+// animations that don't repeat is over.
+static int finishing = 0;
+
+
+/**
+ * The idea is that this animates button lights 0..20 (21 in total) in
+ * order with a slight delay.
+ */
+#define ANIMATE_COLUMNS     11
+#define ANIMATE_COLUMN_MS   30
+#define ANIMATE_LED_MS      5
+
+static const signed char animation_sequence[ANIMATE_COLUMNS][5] = {
+    {  0,  3,  6,  9, 19 },
+    {  1,  4,  7, 10, 20 },
+    {  2,  5,  8, 11, -1 },
+    { -1, -1, -1, -1, -1 }, // pause between these columns
+    { 12, 13, 14, -1, -1 },
+    { 12, 13, 15, -1, -1 },
+    { -1, -1, -1, -1, -1 }, // pause between these columns
+    { -1, -1, -1, -1, -1 }, // pause between these columns
+    { 16, -1, -1, -1, -1 },
+    { 17, -1, -1, -1, -1 },
+    { 18, -1, -1, -1, -1 }
+};
+
+// The brightness steps of a pulse, which go up and back down again.
+#define PULSE_STEPS         6
+#define PULSE_STEP_MS       100
+#define PULSE_DIM           0x10
+
+#define BLINK_MS            300
+
+
+static void animation_add( animation_t * animation, int millis, int index, int state )
+{
+    if (animation->length >= ANIMATION_MAX_KEYFRAMES) return;
+
+    animation->keyframes[ animation->length++ ] = (animation_keyframe_t){
+        .millis = millis,
+        .index = index,
+        .state = state
+    };
+}
+
+
+/*
+ * A wipe from right to left, after which the LEDs light up one by one
+ * with a slight delay, because I think it's cool.
+ */
+static void animation_build_start( animation_t * animation )
+{
+    int millis = 0;
+
+    // Nothing is shown until the wipe is over.
+    for(int i=0; i<TOTAL_HID_BUTTONS; i++)
+    {
+        animation_add( animation, 0, i, LED_OFF );
+    }
+
+    for(int i=ANIMATE_COLUMNS-1; i>=0; i--, millis += ANIMATE_COLUMN_MS)
+    {
+        for(int j=0; j<5; j++)
+        {
+            if (i < ANIMATE_COLUMNS - 1 && animation_sequence[i+1][j] >= 0)
+            {
+                animation_add( animation, millis, animation_sequence[i+1][j], LED_OFF );
+            }
+
+            if (animation_sequence[i][j] >= 0)
+            {
+                animation_add( animation, millis, animation_sequence[i][j], LED_ON );
+            }
+        }
+    }
+
+    for(int i=0; i<TOTAL_HID_BUTTONS; i++)
+    {
+        animation_add( animation, millis, i, LED_OFF );
+    }
+
+    for(int i=0; i<TOTAL_HID_BUTTONS; i++)
+    {
+        animation_add( animation, millis + i * ANIMATE_LED_MS, i, LED_BASE );
+    }
+}
+
+
+/*
+ * This turns all the buttons off, from index 0 to 21 with a slight
+ * delay in between.
+ */
+static void animation_build_stop( animation_t * animation )
+{
+    for(int i=0; i<TOTAL_HID_BUTTONS; i++)
+    {
+        animation_add( animation, i * ANIMATE_LED_MS, i, LED_OFF );
+    }
+}
+
+
+static void animation_build_blink( animation_t * animation )
+{
+    animation_add( animation, 0, ANIMATION_SELF, LED_BRIGHT );
+    animation_add( animation, BLINK_MS, ANIMATION_SELF, LED_OFF );
+
+    animation->period = 2 * BLINK_MS;
+}
+
+
+static void animation_build_pulse( animation_t * animation )
+{
+    for(int step=0; step<2 * PULSE_STEPS; step++)
+    {
+        const int level = step <= PULSE_STEPS ? step : 2 * PULSE_STEPS - step;
+
+        animation_add( animation, step * PULSE_STEP_MS, ANIMATION_SELF,
+            PULSE_DIM + (LED_BRIGHT - PULSE_DIM) * level / PULSE_STEPS );
+    }
+
+    animation->period = 2 * PULSE_STEPS * PULSE_STEP_MS;
+}
+
+
+/*
+ * Arms the timer for the next keyframe that is due, or disarms it when
+ * nothing is playing.
+ */
+static void animation_schedule()
+{
+    uint64_t next = 0;
+
+    for(int i=0; i<ANIMATION_MAX_PLAYING; i++)
+    {
+        const animation_playing_t * slot = &playing[i];
+        if (slot->device < 0) continue;
+
+        // At the end of one that repeats, the first keyframe is next.
+        uint64_t due = slot->start;
+        if (slot->next < slot->animation->length)
+        {
+            due += slot->animation->keyframes[ slot->next ].millis * 1000000ULL;
+        }
+        else
+        {
+            due += slot->animation->period * 1000000ULL;
+        }
+
+        if (next == 0 || due < next) next = due;
+    }
+
+    if (next == 0)
+    {
+        evloop_timer_set( timer, 0, 0 );
+        return;
+    }
+
+    if (next < drawn + frame_ns) next = drawn + frame_ns;
+    evloop_timer_set_at( timer, next );
+}
+
+
+/*
+ * Returns how many of the animations that don't repeat are playing.
+ */
+static int animation_busy()
+{
+    int busy = 0;
+
+    for(int i=0; i<ANIMATION_MAX_PLAYING; i++)
+    {
+        if (playing[i].device > -1 && playing[i].animation->period == 0) busy++;
+    }
+
+    return busy;
+}
+
+
+/*
+ * Shows the keyframes of `slot` that are due, and starts it over or
+ * ends it after the last one.
+ *
+ * Returns whether any LED was changed.
+ */
+static int animation_advance( animation_playing_t * slot, uint64_t now )
+{
+    const animation_t * animation = slot->animation;
+    int changed = 0;
+
+    for(;;)
+    {
+        if (slot->next >= animation->length)
+        {
+            if (animation->period == 0 || animation->length == 0)
+            {
+                slot->device = -1;
+                break;
+            }
+
+            // Once it fell behind by more than a period, it starts over
+            // from now instead of catching up.
+            slot->start += animation->period * 1000000ULL;
+            if (slot->start + animation->period * 1000000ULL < now) slot->start = now;
+
+            slot->next = 0;
+        }
+
+        const animation_keyframe_t * keyframe = &animation->keyframes[ slot->next ];
+        if (slot->start + keyframe->millis * 1000000ULL > now) break;
+
+        const int index = keyframe->index == ANIMATION_SELF ? slot->led : keyframe->index;
+        if (index > -1)
+        {
+            leds_overlay( slot->device, index, keyframe->state );
+            changed = 1;
+        }
+
+        slot->next++;
+    }
+
+    return changed;
+}
+
+
+static void animation_on_timer( int fd, unsigned int events, void * data )
+{
+    const uint64_t now = evloop_now();
+    int changed[ HID_MAX_DEVICES ] = { 0 };
+
+    for(int i=0; i<ANIMATION_MAX_PLAYING; i++)
+    {
+        const int device = playing[i].device;
+        if (device < 0) continue;
+
+        if (animation_advance( &playing[i], now )) changed[ device ] = 1;
+    }
+
+    for(int device=0; device<HID_MAX_DEVICES; device++)
+    {
+        if (changed[ device ]) leds_sync( device );
+    }
+
+    drawn = now;
+
+    if (finishing && animation_busy() == 0)
+    {
+        evloop_stop( animation_loop );
+        return;
+    }
+
+    animation_schedule();
+}
+
+
+/*
+ * Builds the animations and adds their timer to `loop`. They are drawn
+ * at most once every `frame_nanos`.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int animation_init( evloop_t * loop, uint64_t frame_nanos )
+{
+    memset( animations, 0, sizeof animations );
+
+    animation_build_start( &animations[ ANIMATION_START ] );
+    animation_build_stop( &animations[ ANIMATION_STOP ] );
+    animation_build_blink( &animations[ ANIMATION_BLINK ] );
+    animation_build_pulse( &animations[ ANIMATION_PULSE ] );
+
+    for(int i=0; i<ANIMATION_MAX_PLAYING; i++)
+    {
+        playing[i].device = -1;
+    }
+
+    animation_loop = loop;
+    frame_ns = frame_nanos;
+    drawn = 0;
+    finishing = 0;
+
+    timer = evloop_timer_new( loop, animation_on_timer, NULL );
+    return timer < 0 ? -1 : 0;
+}
+
+
+/*
+ * Stops everything and removes the timer from the loop.
+ */
+void animation_exit()
+{
+    if (animation_loop) evloop_timer_free( animation_loop, timer );
+
+    for(int i=0; i<ANIMATION_MAX_PLAYING; i++)
+    {
+        playing[i].device = -1;
+    }
+
+    animation_loop = NULL;
+    timer = -1;
+}
+
+
+/*
+ * Plays `animation` on the LEDs of the HID `device`. With `led` it is
+ * played on that LED only (for ANIMATION_BLINK and ANIMATION_PULSE),
+ * where it goes on if it is already playing there. Otherwise it is for
+ * the whole keyboard, and replaces whatever played on it.
+ *
+ * Called on the thread that runs the loop.
+ */
+void animation_play( int device, int animation, int led )
+{
+    animation_playing_t * slot = NULL;
+
+    if (timer < 0 || device < 0 || device >= HID_MAX_DEVICES
+        || animation < 0 || animation >= ANIMATION_COUNT
+        || led >= TOTAL_HID_BUTTONS) return;
+
+    for(int i=0; i<ANIMATION_MAX_PLAYING; i++)
+    {
+        if (playing[i].device != device) continue;
+
+        if (led < 0)
+        {
+            playing[i].device = -1;
+        }
+        else if (playing[i].led == led)
+        {
+            if (playing[i].animation == &animations[ animation ]) return;
+            slot = &playing[i];
+        }
+    }
+
+    for(int i=0; i<ANIMATION_MAX_PLAYING && !slot; i++)
+    {
+        if (playing[i].device < 0) slot = &playing[i];
+    }
+
+    if (!slot) return;
+
+    const uint64_t now = evloop_now();
+    const uint64_t period = animations[ animation ].period * 1000000ULL;
+
+    slot->animation = &animations[ animation ];
+    slot->device = device;
+    slot->led = led;
+    slot->next = 0;
+    slot->start = now;
+
+    // One that repeats on a single LED keeps to the same beat whenever
+    // it starts, so when it is stopped and played again (like for a
+    // layer) it goes on where it was rather than start over.
+    if (led > -1 && period > 0) slot->start = now - now % period;
+
+    animation_schedule();
+}
+
+
+/*
+ * Stops what plays on `led` of the HID `device` with `animation_play()`,
+ * after which it shows what it is set to again with the next
+ * `leds_sync()`.
+ */
+void animation_stop( int device, int led )
+{
+    for(int i=0; i<ANIMATION_MAX_PLAYING; i++)
+    {
+        if (playing[i].device == device && playing[i].led == led && led > -1)
+        {
+            playing[i].device = -1;
+            leds_overlay( device, led, LED_BASE );
+        }
+    }
+}
+
+
+/*
+ * Returns the animation that plays on `led` of the HID `device`, -1 if
+ * there is none.
+ */
+int animation_playing( int device, int led )
+{
+    for(int i=0; i<ANIMATION_MAX_PLAYING; i++)
+    {
+        if (playing[i].device == device && playing[i].led == led && led > -1)
+        {
+            return playing[i].animation - animations;
+        }
+    }
+
+    return -1;
+}
+
+
+/*
+ * Stops the animations that repeat, and has the loop stop once the
+ * others are over.
+ *
+ * Returns how many are still playing, the loop isn't stopped if there
+ * are none.
+ */
+int animation_finish()
+{
+    for(int i=0; i<ANIMATION_MAX_PLAYING; i++)
+    {
+        if (playing[i].device > -1 && playing[i].animation->period > 0)
+        {
+            playing[i].device = -1;
+        }
+    }
+
+    finishing = 1;
+    return animation_busy();
+}
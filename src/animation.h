@@ -0,0 +1,66 @@
+#ifndef _ANIMATION_H_
+#define _ANIMATION_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "event_loop.h"
+#include "button_leds.h"
+#include "hid.h"
+
+// The animations `animation_play()` knows.
+#define ANIMATION_START         0   // a wipe, after which the LEDs light up one by one
+#define ANIMATION_STOP          1   // switches the LEDs off one by one
+#define ANIMATION_BLINK         2   // blinks a single LED
+#define ANIMATION_PULSE         3   // fades a single LED in and out
+#define ANIMATION_COUNT         4
+
+// The most keyframes an animation can have, and how many can play at
+// the same time.
+#define ANIMATION_MAX_KEYFRAMES 128
+#define ANIMATION_MAX_PLAYING   (HID_MAX_DEVICES * 8)
+
+// The keyframe is for the LED the animation is played on.
+#define ANIMATION_SELF          -1
+
+/*
+ * At `millis` after the animation started, the LED `index` shows `state`
+ * (LED_OFF .. LED_BRIGHT, or LED_BASE to show what it would without the
+ * animation).
+ */
+typedef struct animation_keyframe_t {
+    unsigned short millis;
+    signed char index;
+    signed char state;
+} animation_keyframe_t;
+
+/*
+ * The keyframes are in the order they are shown. An animation with a
+ * `period` starts over every `period` milliseconds until it is stopped,
+ * the others end after their last keyframe.
+ */
+typedef struct animation_t {
+    animation_keyframe_t keyframes[ ANIMATION_MAX_KEYFRAMES ];
+    int length;
+    unsigned short period;
+} animation_t;
+
+typedef struct animation_playing_t {
+    const animation_t * animation;
+    int device; // the HID device, -1 if this one is free
+    int led;    // for ANIMATION_SELF, -1 if it is for the whole keyboard
+    int next;   // the keyframe that is shown next
+    uint64_t start;
+} animation_playing_t;
+
+int animation_init( evloop_t * loop, uint64_t frame_ns );
+void animation_exit();
+
+void animation_play( int device, int animation, int led );
+void animation_stop( int device, int led );
+int animation_playing( int device, int led );
+int animation_finish();
+
+#endif /* _ANIMATION_H_ */
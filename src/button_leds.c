@@ -2,18 +2,73 @@
 
 /*
  * Buffer for the HID data that is sent to the device to 
- * change the state.
+ * change the state, one for every HID device.
  */
-static unsigned char button_hid_data[ 1 + TOTAL_HID_BUTTONS ]; // so 22 items, 21 max index
+static unsigned char button_hid_data[ HID_MAX_DEVICES ][ 1 + TOTAL_HID_BUTTONS ]; // so 22 items, 21 max index
+
+/*
+ * Set when the buffer differs from what the device shows, so a sync
+ * without any changes doesn't cost a HID write. It can be set from any
+ * thread with `leds_invalidate()`.
+ */
+static _Atomic int dirty[ HID_MAX_DEVICES ];
+
+/*
+ * What every LED is set to, and what an animation shows on top of that
+ * (LED_BASE if nothing). The buffer holds whichever of the two it shows.
+ */
+static unsigned char state[ HID_MAX_DEVICES ][ TOTAL_HID_BUTTONS ];
+static signed char overlay[ HID_MAX_DEVICES ][ TOTAL_HID_BUTTONS ];
+
+/*
+ * While the writer thread runs, `leds_sync()` only posts the buffer
+ * here and the writer does the (possibly slow) HID write. A frame that
+ * wasn't written yet is replaced by the newer one, as only the latest
+ * state is worth sending.
+ */
+static unsigned char mailbox[ HID_MAX_DEVICES ][ 1 + TOTAL_HID_BUTTONS ];
+static int posted[ HID_MAX_DEVICES ];
+static pthread_mutex_t mailbox_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mailbox_ready = PTHREAD_COND_INITIALIZER;
+
+// Only changed by the main thread, while no other thread syncs.
+static pthread_t writer;
+static int writer_running = 0;
+static int writer_stopping = 0;
+
+static unsigned long frames_posted = 0;
+static unsigned long frames_written = 0;
+static unsigned long frames_replaced = 0;
+
+
+
+/*
+ * Puts what a LED shows in the buffer.
+ */
+static void leds_show( int device, int index )
+{
+    const unsigned char shown = overlay[ device ][ index ] == LED_BASE
+        ? state[ device ][ index ]
+        : overlay[ device ][ index ];
+
+    if (button_hid_data[ device ][ index + 1 ] != shown)
+    {
+        button_hid_data[ device ][ index + 1 ] = shown;
+        atomic_store( &dirty[ device ], 1 );
+    }
+}
 
 
 
 /*
  * Clear out all leds to 'off'
  */
-void leds_clear()
+void leds_clear( int device )
 {
-    memset(button_hid_data + 1,0,TOTAL_HID_BUTTONS);
+    for(int i=0; i<TOTAL_HID_BUTTONS; i++)
+    {
+        leds_update_led( device, i, LED_OFF );
+    }
 }
 
 
@@ -22,157 +77,209 @@ void leds_clear()
  * This initialises the internal buffer that is sent
  * over the wire as HID data.
  */
-void leds_init()
+void leds_init( int device )
 {
     // Initialise the hid data packet.
-    button_hid_data[ 0 ] = 0x80;
-    leds_clear();
+    button_hid_data[ device ][ 0 ] = 0x80;
+    memset( overlay[ device ], LED_BASE, sizeof overlay[ device ] );
+    leds_clear( device );
+
+    // Whatever the device shows now, it isn't known.
+    leds_invalidate( device );
 }
 
 
 
 /*
- * Updates a single LED. State is either LED_OFF, LED_ON
+ * Updates a single LED, `value` is either LED_OFF, LED_ON
  * or LED_BRIGHT.
  * 
  * This still requires a call to `leds_sync()` to actually
  * send it over to the device.
  */
-void leds_update_led( int index, int state )
+void leds_update_led( int device, int index, int value )
 {
-    if (index < TOTAL_HID_BUTTONS)
+    if (index >= 0 && index < TOTAL_HID_BUTTONS)
     {
-        button_hid_data[ index + 1 ] = state;
+        state[ device ][ index ] = value;
+        leds_show( device, index );
     }
 }
 
 
 /*
- * Syncs the LED state.
+ * Has a LED show `value` instead of what it is set to, until it is
+ * handed back with LED_BASE. This is what the animations draw with,
+ * and it also needs a `leds_sync()`.
  */
-int leds_sync()
+void leds_overlay( int device, int index, int value )
+{
+    if (index >= 0 && index < TOTAL_HID_BUTTONS)
+    {
+        overlay[ device ][ index ] = value;
+        leds_show( device, index );
+    }
+}
+
+
+/*
+ * Writes a frame to the device.
+ */
+static int leds_write( int device, unsigned char * frame )
 {
     char receive_buffer[ 22 ];
-    return hidstuff_send_raw( 
-        button_hid_data, 
-        sizeof button_hid_data,
+
+    const int result = hidstuff_send_raw( device,
+        frame,
+        sizeof button_hid_data[ device ],
         receive_buffer,
         0
     );
+
+    // Try again with the next sync.
+    if (result < 0) atomic_store( &dirty[ device ], 1 );
+
+    return result;
 }
 
 
-/** 
- * The idea is that this animates button lights 0..20 (21 in total) in 
- * order with a slight delay.
+/*
+ * Syncs the LED state, if anything changed since the last time. With
+ * the writer thread running, this only hands it the frame.
+ * 
+ * Returns -1 if it could not be written.
  */
-#define ANIMATE_COLUMNS     11
-#define ANIMATE_DELAY       30000
+int leds_sync( int device )
+{
+    if (!atomic_exchange( &dirty[ device ], 0 )) return 0;
 
-#define ANIMWAIT            leds_sync(); usleep( ANIMATE_DELAY )
+    if (!writer_running) return leds_write( device, button_hid_data[ device ] );
 
-static char animation_sequence[ANIMATE_COLUMNS][5] = {
-    {  0,  3,  6,  9, 19 },
-    {  1,  4,  7, 10, 20 },
-    {  2,  5,  8, 11, -1 },
-    { -1, -1, -1, -1, -1 }, // pause between these columns
-    { 12, 13, 14, -1, -1 },
-    { 12, 13, 15, -1, -1 },
-    { -1, -1, -1, -1, -1 }, // pause between these columns
-    { -1, -1, -1, -1, -1 }, // pause between these columns
-    { 16, -1, -1, -1, -1 },
-    { 17, -1, -1, -1, -1 },
-    { 18, -1, -1, -1, -1 }
-};
+    pthread_mutex_lock( &mailbox_lock );
 
+    if (posted[ device ]) frames_replaced++;
+    memcpy( mailbox[ device ], button_hid_data[ device ], sizeof mailbox[ device ] );
+    posted[ device ] = 1;
+    frames_posted++;
 
-void leds_animate_on()
-{   
-/*
-    // Wipe from Left to Right
-    for(int i=0; i<ANIMATE_COLUMNS; i++)
+    pthread_cond_signal( &mailbox_ready );
+    pthread_mutex_unlock( &mailbox_lock );
+
+    return 0;
+}
+
+
+static void * leds_run_writer( void * arg )
+{
+    unsigned char frame[ sizeof mailbox[0] ];
+    int device = 0;
+
+    pthread_mutex_lock( &mailbox_lock );
+
+    for(;;)
     {
-        for(int j=0; j<5; j++)
+        // The devices take turns, starting after the last one written.
+        int found = -1;
+        for(int i=1; i<=HID_MAX_DEVICES && found < 0; i++)
         {
-            if (animation_sequence[i][j] >= 0)
-            {
-                update_button_led( animation_sequence[i][j], 1 );
-            }
-            
-            if (i > 0)
-            {
-                if (animation_sequence[i-1][j] >= 0)
-                {
-                    update_button_led( animation_sequence[i-1][j], 0 );
-                }
-            }
+            if (posted[ (device + i) % HID_MAX_DEVICES ]) found = (device + i) % HID_MAX_DEVICES;
         }
-        
-        ANIMWAIT;
-    }
-*/
 
-    // Wipe from Right to Left
-    for(int i=ANIMATE_COLUMNS-1; i>=0; i--)
-    {
-        for(int j=0; j<5; j++)
+        if (found < 0)
         {
-            if (animation_sequence[i][j] >= 0)
-            {
-                leds_update_led( animation_sequence[i][j], LED_ON );
-            }
-            
-            if (i < ANIMATE_COLUMNS - 1)
-            {
-                if (animation_sequence[i+1][j] >= 0)
-                {
-                    leds_update_led( animation_sequence[i+1][j], LED_OFF );
-                }
-            }
+            // Whatever was posted is written before it stops.
+            if (writer_stopping) break;
+
+            pthread_cond_wait( &mailbox_ready, &mailbox_lock );
+            continue;
         }
-        
-        ANIMWAIT;
-    }
-    
-#ifdef SIMPLE_ORDER
-    for(int i=0; i<TOTAL_HID_BUTTONS; i++)
-    {
-        leds_update_led( i, LED_ON ); // turn on
-        leds_sync();
-        usleep( 155000 );
-        
-        leds_update_led( i, LED_OFF ); // turn off
-        leds_sync();
+
+        device = found;
+        memcpy( frame, mailbox[ device ], sizeof frame );
+        posted[ device ] = 0;
+
+        pthread_mutex_unlock( &mailbox_lock );
+        const int result = leds_write( device, frame );
+        pthread_mutex_lock( &mailbox_lock );
+
+        if (result >= 0) frames_written++;
     }
-    
-#endif
 
-    // Finally turn them all off.
-    leds_off();
+    pthread_mutex_unlock( &mailbox_lock );
+    return NULL;
 }
 
 
+/*
+ * Starts the thread that does the HID writes of `leds_sync()`, so it
+ * doesn't wait for the device. Without it, they are written right away.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int leds_start_writer()
+{
+    if (writer_running) return 0;
+
+    writer_stopping = 0;
+    if (pthread_create( &writer, NULL, leds_run_writer, NULL ) != 0) return -1;
+
+    writer_running = 1;
+    return 0;
+}
+
 
 /*
- * This turns all the buttons off, from index 0 to 21 with 
- * a slight delay in between.
+ * Writes what is still posted and stops the writer thread, after which
+ * `leds_sync()` writes right away again.
  */
-void leds_animate_off()
+void leds_stop_writer()
 {
-    for(int i=0; i < TOTAL_HID_BUTTONS; i++)
+    if (!writer_running) return;
+
+    pthread_mutex_lock( &mailbox_lock );
+    writer_stopping = 1;
+    pthread_cond_signal( &mailbox_ready );
+    pthread_mutex_unlock( &mailbox_lock );
+
+    pthread_join( writer, NULL );
+    writer_running = 0;
+}
+
+
+/*
+ * Prints the writer counters.
+ */
+void leds_print_stats()
+{
+    printf( "LED writes: %lu frames posted, %lu written, %lu replaced by a newer one.\n",
+        frames_posted, frames_written, frames_replaced );
+}
+
+
+/*
+ * Has the next `leds_sync()` write all the LEDs, for when the device
+ * has forgotten them (after it was unplugged). Can be called from any
+ * thread.
+ */
+void leds_invalidate( int device )
+{
+    if (device >= 0 && device < HID_MAX_DEVICES)
     {
-        leds_update_led( i, LED_OFF );
-        leds_sync(); 
-        
-        usleep( 5000 );
-    }        
+        atomic_store( &dirty[ device ], 1 );
+    }
 }
 
+
 /*
- * Turns all LEDs off, without any delay.
+ * Turns all LEDs off, without any delay, whatever played on them.
  */
-void leds_off()
+void leds_off( int device )
 {
-    leds_clear();
-    leds_sync();
+    for(int i=0; i<TOTAL_HID_BUTTONS; i++)
+    {
+        overlay[ device ][ i ] = LED_BASE;
+    }
+
+    leds_clear( device );
+    leds_sync( device );
 }
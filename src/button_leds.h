@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include "hid.h"
 
@@ -14,12 +16,19 @@
 #define LED_ON              0x7c
 #define LED_OFF             0x00
 
-void leds_init();
-void leds_clear();
-void leds_update_led( int index, int state );
-int leds_sync();
-void leds_animate_on();
-void leds_animate_off();
-void leds_off();
+// For `leds_overlay()`, the LED shows what it is set to.
+#define LED_BASE            -1
+
+void leds_init( int device );
+void leds_clear( int device );
+void leds_update_led( int device, int index, int state );
+int leds_sync( int device );
+void leds_overlay( int device, int index, int value );
+void leds_invalidate( int device );
+void leds_off( int device );
+
+int leds_start_writer();
+void leds_stop_writer();
+void leds_print_stats();
 
 #endif /* _BUTTON_LEDS_H_ */
@@ -17,7 +17,7 @@
 
 // This is the button total + the extra buttons for the turning
 // of the dial.
-#define REAL_BUTTON_TOTAL   TOGGLE_BUTTON_TOTAL + 2
+#define REAL_BUTTON_TOTAL   (TOGGLE_BUTTON_TOTAL + 2)
 
 const char * get_button_name(int);
 int get_button_index( char * );
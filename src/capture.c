@@ -0,0 +1,117 @@
+#include "capture.h"
+
+/*
+ * Opens a recording for writing (which truncates it) or reading.
+ *
+ * Returns -1 on error (or if it is not a recording), 0 if all is well.
+ */
+int capture_open( capture_t * capture, const char * path, int writing )
+{
+    char magic[ CAPTURE_MAGIC_SZ ];
+
+    capture->last = 0;
+    capture->file = fopen( path, writing ? "wb" : "rb" );
+    if (!capture->file) return -1;
+
+    if (writing)
+    {
+        if (fwrite( CAPTURE_MAGIC, CAPTURE_MAGIC_SZ, 1, capture->file ) == 1)
+        {
+            return 0;
+        }
+    }
+    else if (fread( magic, CAPTURE_MAGIC_SZ, 1, capture->file ) == 1
+        && memcmp( magic, CAPTURE_MAGIC, CAPTURE_MAGIC_SZ ) == 0)
+    {
+        return 0;
+    }
+
+    capture_close( capture );
+    return -1;
+}
+
+
+void capture_close( capture_t * capture )
+{
+    if (capture->file) fclose( capture->file );
+    capture->file = NULL;
+}
+
+
+/*
+ * Appends a report that came in at `timestamp` (CLOCK_MONOTONIC
+ * nanoseconds). The writes are buffered.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int capture_write( capture_t * capture, uint64_t timestamp, const unsigned char * report, int length )
+{
+    unsigned char header[ 11 ];
+    int header_length = 0;
+
+    if (!capture->file || length <= 0 || length > 255) return -1;
+
+    const uint64_t micros = timestamp / 1000;
+    uint64_t delta = micros >= capture->last ? micros - capture->last : 0;
+    capture->last = micros;
+
+    do
+    {
+        header[ header_length ] = delta & 0x7f;
+        delta >>= 7;
+        if (delta) header[ header_length ] |= 0x80;
+        header_length++;
+    }
+    while (delta);
+
+    header[ header_length++ ] = length;
+
+    if (fwrite( header, header_length, 1, capture->file ) != 1
+        || fwrite( report, length, 1, capture->file ) != 1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Reads the next report and its timestamp (CLOCK_MONOTONIC nanoseconds
+ * at the time it was recorded).
+ *
+ * Returns -1 on error, 0 at the end of the recording, the length of the
+ * report otherwise.
+ */
+int capture_read( capture_t * capture, uint64_t * timestamp, unsigned char * report, int max_length )
+{
+    uint64_t delta = 0;
+    int shift = 0;
+    int c;
+
+    if (!capture->file) return -1;
+
+    do
+    {
+        c = fgetc( capture->file );
+        if (c == EOF) return shift == 0 ? 0 : -1;
+        if (shift > 63) return -1;
+
+        delta |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    }
+    while (c & 0x80);
+
+    const int length = fgetc( capture->file );
+    if (length == EOF || length == 0 || length > max_length) return -1;
+
+    if (fread( report, length, 1, capture->file ) != 1)
+    {
+        return -1;
+    }
+
+    capture->last += delta;
+    *timestamp = capture->last * 1000;
+
+    return length;
+}
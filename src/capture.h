@@ -0,0 +1,35 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// The file starts with these 8 bytes, the last one being the version.
+#define CAPTURE_MAGIC       "KKCAP\0\0\1"
+#define CAPTURE_MAGIC_SZ    8
+
+/*
+ * A recording of raw HID reports. Every report is stored as:
+ *
+ *   <delta> <length> <report bytes>
+ *
+ * where <delta> is the number of microseconds (CLOCK_MONOTONIC) since
+ * the previous report (or since boot, for the first one) as an unsigned
+ * LEB128 varint, and <length> is a single byte.
+ */
+typedef struct capture_t {
+    FILE * file;
+
+    // The timestamp of the previous report, in microseconds.
+    uint64_t last;
+} capture_t;
+
+int capture_open( capture_t * capture, const char * path, int writing );
+void capture_close( capture_t * capture );
+
+int capture_write( capture_t * capture, uint64_t timestamp, const unsigned char * report, int length );
+int capture_read( capture_t * capture, uint64_t * timestamp, unsigned char * report, int max_length );
+
+#endif /* _CAPTURE_H_ */
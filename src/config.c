@@ -4,6 +4,179 @@
 // The line size in the configuration file.
 #define BUFFER_SZ 256
 
+
+/*
+ * Parses the acceleration curve, `<millis>:<factor>` pairs separated
+ * by commas, e.g. `50:2,20:4`.
+ * 
+ * Returns -1 if it cannot be parsed.
+ */
+static int config_parse_accel( char * value, mapping_key_t * mapping )
+{
+    char * save = NULL;
+    
+    mapping->accel_length = 0;
+    for(char * step = strtok_r( value, ",", &save ); step; step = strtok_r( NULL, ",", &save ))
+    {
+        int millis, factor;
+        if (mapping->accel_length == MAX_ACCEL_STEPS
+            || sscanf( step, "%d:%d", &millis, &factor ) != 2
+            || millis <= 0 || factor <= 0)
+        {
+            return -1;
+        }
+        
+        mapping->accel[ mapping->accel_length ].millis = millis;
+        mapping->accel[ mapping->accel_length ].factor = factor;
+        mapping->accel_length++;
+    }
+    
+    return 0;
+}
+
+
+/*
+ * Parses the auto-repeat, `<delay>,<rate>` in milliseconds and times
+ * per second, e.g. `300,25`.
+ *
+ * Returns -1 if it cannot be parsed.
+ */
+static int config_parse_repeat( char * value, mapping_key_t * mapping )
+{
+    int delay, rate;
+    if (sscanf( value, "%d,%d", &delay, &rate ) != 2
+        || delay < 0 || rate <= 0 || rate > 1000)
+    {
+        return -1;
+    }
+
+    mapping->repeat_delay = delay;
+    mapping->repeat_rate = rate;
+    return 0;
+}
+
+
+/*
+ * Parses what lights the button up, an MMC command or a MIDI message
+ * like `MMC_Play` or `Note:1:94`.
+ *
+ * Returns -1 if it cannot be parsed.
+ */
+static int config_parse_led( char * value, mapping_key_t * mapping )
+{
+    int midi_key = 0;
+    const int mmc_code = mmc_key_parse( value );
+    const int midi_type = mmc_code == -1 ? midi_parse( value, &midi_key ) : -1;
+
+    if (mmc_code > -1)
+    {
+        mapping->led = MAP_MMC_KEY(mmc_code);
+    }
+    else if (midi_type > -1)
+    {
+        mapping->led = MAP_MIDI(midi_type, midi_key);
+    }
+    else
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Parses the options after the keys, like so:
+ * 
+ * 4D CW=LeftCtrl,Equal;accel=50:2,20:4;max=8
+ * 4D CW=Wheel;scale=60
+ * 4D Right=Right;repeat=300,25
+ * Play=MMC_Play;device=1
+ * Metro=CC:1:64;toggle
+ * Play=Space;led=MMC_Play
+ * Record=MMC_Record_Strobe;blink
+ * Browser=Layer1;latch
+ * 
+ * Unknown or malformed options are reported and ignored.
+ */
+static void config_parse_options( char * options, mapping_key_t * mapping, int line_counter )
+{
+    char * save = NULL;
+    
+    for(char * option = strtok_r( options, ";", &save ); option; option = strtok_r( NULL, ";", &save ))
+    {
+        char * value = strchr( option, '=' );
+        if (value) *value++ = '\0';
+        
+        if (value && strcasecmp( option, "max" ) == 0)
+        {
+            mapping->max_events = atoi( value );
+        }
+        else if (value && strcasecmp( option, "scale" ) == 0)
+        {
+            mapping->scale = atoi( value );
+            if (mapping->scale == 0)
+            {
+                printf( "Bad scale on line %d\n", line_counter );
+            }
+        }
+        else if (value && strcasecmp( option, "device" ) == 0)
+        {
+            mapping->mmc_device = atoi( value );
+            if (mapping->mmc_device < 0 || mapping->mmc_device >= MMC_DEVICES)
+            {
+                printf( "Bad MMC device ID on line %d\n", line_counter );
+                mapping->mmc_device = MMC_DEVICE_ALL;
+            }
+        }
+        else if (value && strcasecmp( option, "repeat" ) == 0)
+        {
+            if (config_parse_repeat( value, mapping ) < 0)
+            {
+                printf( "Bad repeat on line %d\n", line_counter );
+                mapping->repeat_rate = 0;
+            }
+        }
+        else if (value && strcasecmp( option, "led" ) == 0)
+        {
+            if (config_parse_led( value, mapping ) < 0)
+            {
+                printf( "Bad led on line %d\n", line_counter );
+                mapping->led = MAP_KEY(0);
+            }
+        }
+        else if (!value && strcasecmp( option, "toggle" ) == 0)
+        {
+            mapping->toggle = 1;
+        }
+        else if (!value && strcasecmp( option, "latch" ) == 0)
+        {
+            mapping->latch = 1;
+        }
+        else if (!value && strcasecmp( option, "blink" ) == 0)
+        {
+            mapping->led_style = MAPPING_LED_BLINK;
+        }
+        else if (!value && strcasecmp( option, "pulse" ) == 0)
+        {
+            mapping->led_style = MAPPING_LED_PULSE;
+        }
+        else if (value && strcasecmp( option, "accel" ) == 0)
+        {
+            if (config_parse_accel( value, mapping ) < 0)
+            {
+                printf( "Bad acceleration curve on line %d\n", line_counter );
+                mapping->accel_length = 0;
+            }
+        }
+        else
+        {
+            printf( "Unknown option `%s` at line %d\n", option, line_counter );
+        }
+    }
+}
+
+
 /*
  * Read configuration file. This is very straight-forward and naive. 
  * 
@@ -11,8 +184,10 @@
  * 
  * Button0=LeftCtrl,Z
  * Button39=LeftCtrl,LeftShift,Z
+ *
+ * The buttons are mapped in `mappings`, which should be initialised.
  */
-int config_read( char * filename, int verbose )
+int config_read( mapping_t * mappings, char * filename, int verbose )
 {
     int config_read_result = 0;
     
@@ -74,15 +249,17 @@ int config_read( char * filename, int verbose )
     
     int button_index = -1;
     
-    // The "Shift+Mute" can also be used as input.
-    int shifted = 0; // keyboard button is shifted
+    // The "Shift+Mute" (or "Layer1+Mute") can also be used as input.
+    int layer = MAPPING_LAYER_NONE; // the layer of the mapping
     int comment = 0; // line is a comment
+    int options = 0; // reading the options after a `;`
     
     int line_counter = 1;
     
     // For parsing / storing the single mapping configuration.
     mapping_key_t mapping;
-    mapping.length = 0;
+    memset( &mapping, 0, sizeof mapping );
+    mapping.mmc_device = MMC_DEVICE_ALL;
     
     while (!end_of_file)
     {
@@ -129,7 +306,7 @@ int config_read( char * filename, int verbose )
                 line_counter++;
                 
                 comment = 0;
-                shifted = 0;
+                layer = MAPPING_LAYER_NONE;
                 
                 goto restart_buffer;
             }
@@ -169,20 +346,33 @@ int config_read( char * filename, int verbose )
                 }     
                 else if (c == '+')
                 {
-                    // This could be "Shift+Mono" which can have
-                    // a different mapping.
+                    // This could be "Shift+Mono" or "Layer1+Mono" which
+                    // can have a different mapping.
                     size_t len = strlen(buffer);
                     if (strncasecmp( "Shift", buffer, len ) == 0)
                     {
-                        shifted = 1;
+                        layer = MAPPING_LAYER_SHIFT;
+                        goto restart_buffer;
+                    }
+                    else if (mapping_layer_parse( buffer ) > -1)
+                    {
+                        layer = mapping_layer_parse( buffer );
                         goto restart_buffer;
                     }
                 }
             }
         }
+        else if (options)
+        {
+            // The options are parsed all at once at the end of the line.
+            if (c == '\n')
+            {
+                goto parse_key;
+            }
+        }
         else
         {
-            if (c == '+' || c == ',' || c == '\n')
+            if (c == '+' || c == ',' || c == ';' || c == '\n')
             {
                 // We have found a separator, so the button 
                 // description is in the buffer. 
@@ -190,58 +380,111 @@ int config_read( char * filename, int verbose )
             }
         }
             
-        // Add to the buffer and continue.
-        buffer[ buflen ] = c;
-        buflen++;
+        // Add to the buffer and continue (leaving room for the 
+        // terminator, anything longer is cut off).
+        if (buflen < BUFFER_SZ - 1)
+        {
+            buffer[ buflen ] = c;
+            buflen++;
+        }
         
         continue;
         
 parse_key:
-        // First attempt to parse normal keys, and only attempt to 
-        // match MMC key if we didn't find it.
-        const int key_code = key_parse( buffer );
-        const int mmc_code = key_code == -1 ? mmc_key_parse( buffer ) : -1;
-        
-        if (key_code == -1 && mmc_code == -1)
+        if (options)
         {
-            printf( "Failed to parse key `%s` at line %d\n", buffer, line_counter );
+            config_parse_options( buffer, &mapping, line_counter );
         }
-        else if (mmc_code > -1)
+        else
         {
-            // mapping.type = MAPPING_TYPE_MMC;
-            mapping.keys[ mapping.length ] = MAP_MMC_KEY(mmc_code);
-            mapping.length++;
+            // First attempt to parse normal keys, and only attempt to 
+            // match MMC key (and then the wheels, MIDI and the layers) if
+            // we didn't find it.
+            const int key_code = key_parse( buffer );
+            const int mmc_code = key_code == -1 ? mmc_key_parse( buffer ) : -1;
+            const int rel_code = key_code == -1 && mmc_code == -1 ? rel_parse( buffer ) : -1;
+
+            int midi_key = 0;
+            const int midi_type = key_code == -1 && mmc_code == -1 && rel_code == -1
+                ? midi_parse( buffer, &midi_key ) : -1;
+            const int layer_code = key_code == -1 && mmc_code == -1 && rel_code == -1 && midi_type == -1
+                ? mapping_layer_parse( buffer ) : -1;
+            
+            if (key_code == -1 && mmc_code == -1 && rel_code == -1 && midi_type == -1 && layer_code == -1)
+            {
+                printf( "Failed to parse key `%s` at line %d\n", buffer, line_counter );
+            }
+            else if (mapping.length == MAX_KEYS)
+            {
+                printf( "Too many keys at line %d\n", line_counter );
+            }
+            else if (mmc_code > -1)
+            {
+                // mapping.type = MAPPING_TYPE_MMC;
+                mapping.keys[ mapping.length ] = MAP_MMC_KEY(mmc_code);
+                mapping.length++;
+            }
+            else if (rel_code > -1)
+            {
+                mapping.keys[ mapping.length ] = MAP_REL(rel_code);
+                mapping.length++;
+            }
+            else if (midi_type > -1)
+            {
+                mapping.keys[ mapping.length ] = MAP_MIDI(midi_type, midi_key);
+                mapping.length++;
+            }
+            else if (layer_code > -1)
+            {
+                mapping.keys[ mapping.length ] = MAP_LAYER(layer_code);
+                mapping.length++;
+            }
+            else
+            {
+                //mapping.type = MAPPING_TYPE_KEY;
+                mapping.keys[ mapping.length ] = MAP_KEY(key_code);
+                mapping.length++;
+            }
         }
-        else
+        
+        if (c == ';')
         {
-            //mapping.type = MAPPING_TYPE_KEY;
-            mapping.keys[ mapping.length ] = MAP_KEY(key_code);
-            mapping.length++;
+            // Everything up to the end of the line are options.
+            options = 1;
+            goto restart_buffer;
         }
         
         if (c == '\n')
         {   
             // The end of the line. If we have parsed a mapping, 
             // we should assign it.
-            if (shifted) 
-            {
-                mapping_set_shifted( button_index, mapping );
-            }
-            else
-            {
-                mapping_set( button_index, mapping );
-            }
+            mapping_set( mappings, layer, button_index, mapping );
             
             // Verbosity.
             if (verbose)
             {
-                printf( "Button `%s%s` mapped to ", (shifted ? "Shift+" : ""), get_button_name( button_index ) );
+                printf( "Button `%s%s%s` mapped to ", 
+                    mapping_layer_name( layer ), 
+                    (layer != MAPPING_LAYER_NONE ? "+" : ""), 
+                    get_button_name( button_index ) );
                 for(int ki=0; ki<mapping.length; ki++)
                 {
                     if (mapping.keys[ki].type == MAPPING_TYPE_KEY)
                     {
                         printf( "%s", key_name( mapping.keys[ki].key ) );
                     }
+                    else if (mapping.keys[ki].type == MAPPING_TYPE_REL)
+                    {
+                        printf( "%s", rel_name( mapping.keys[ki].key ) );
+                    }
+                    else if (mapping.keys[ki].type == MAPPING_TYPE_LAYER)
+                    {
+                        printf( "%s", mapping_layer_name( mapping.keys[ki].key ) );
+                    }
+                    else if (mapping.keys[ki].type != MAPPING_TYPE_MMC)
+                    {
+                        printf( "%s", midi_name( mapping.keys[ki].type, mapping.keys[ki].key ) );
+                    }
                     else
                     {
                         printf( "%s", mmc_key_name( mapping.keys[ki].key ) );
@@ -259,11 +502,13 @@ parse_key:
             line_counter++;
             
             // Scan for the next button.
-            mapping.length = 0;
+            memset( &mapping, 0, sizeof mapping );
+            mapping.mmc_device = MMC_DEVICE_ALL;
             button_index = -1;
             
-            shifted = 0;
+            layer = MAPPING_LAYER_NONE;
             comment = 0;
+            options = 0;
         }
     
 restart_buffer:
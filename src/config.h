@@ -9,4 +9,4 @@
 #include "mmc_stuff.h"
 #include "mapping.h"
 
-int config_read( char * filename, int verbose );
+int config_read( mapping_t * mappings, char * filename, int verbose );
@@ -0,0 +1,141 @@
+#include "decoder.h"
+
+/*
+ * The report byte and bit of every logical button, in the same order as
+ * the names in button_names.c. The report id is byte 0, so the bitfield
+ * starts at byte 1 and ButtonN sits at bit N of it. If other hardware
+ * sends some of these elsewhere, this table is the only thing that
+ * needs changing.
+ */
+static const decoder_bit_t report_layout[ TOGGLE_BUTTON_TOTAL ] = {
+    { 1, 0 }, { 1, 1 }, { 1, 2 }, { 1, 3 },    // Shift, Scale, Arp, Undo
+    { 1, 4 }, { 1, 5 }, { 1, 6 }, { 1, 7 },    // Quantize, Ideas, Loop, Metro
+    { 2, 0 }, { 2, 1 }, { 2, 2 }, { 2, 3 },    // Tempo, Play, Record, Stop
+    { 2, 4 }, { 2, 5 }, { 2, 6 }, { 2, 7 },    // Preset Up/Down, Mute, Solo
+    { 3, 0 }, { 3, 1 }, { 3, 2 }, { 3, 3 },    // Browser, Plug-In, Track, Octave Down
+    { 3, 4 },                                  // Octave Up
+    { 3, 5 }, { 3, 6 }, { 3, 7 }, { 4, 0 },    // 4D Up, Right, Left, Down
+    { 4, 1 }, { 4, 2 }, { 4, 3 }, { 4, 4 },    // Rotary1..4 touch
+    { 4, 5 }, { 4, 6 }, { 4, 7 }, { 5, 0 },    // Rotary5..8 touch
+    { 5, 1 },                                  // 4D Button
+    { 5, 2 }, { 5, 3 }, { 5, 4 }, { 5, 5 },    // Button34..37
+    { 5, 6 }, { 5, 7 }                         // Button38..39
+};
+
+
+/*
+ * Resets the state and builds the lookup tables from the layout.
+ */
+void decoder_init( decoder_t * decoder )
+{
+    memset( decoder, 0, sizeof(decoder_t) );
+
+    for(int button=0; button<TOGGLE_BUTTON_TOTAL; button++)
+    {
+        const decoder_bit_t * position = &report_layout[ button ];
+
+        // Find (or add) the lookup table for this report byte.
+        int index = 0;
+        while (index < decoder->lut_bytes && decoder->lut_offset[ index ] != position->byte)
+        {
+            index++;
+        }
+
+        if (index == decoder->lut_bytes)
+        {
+            if (decoder->lut_bytes == DECODER_MAX_BYTES) continue;
+
+            decoder->lut_offset[ index ] = position->byte;
+            decoder->lut_bytes++;
+        }
+
+        for(int value=0; value<256; value++)
+        {
+            if (value & (1 << position->bit))
+            {
+                decoder->lut[ index ][ value ] |= 1ULL << button;
+            }
+        }
+    }
+}
+
+
+/*
+ * Compares the report to the previous one and remembers it.
+ *
+ * Returns 0 if it is identical to the previous one (so there is
+ * nothing to do), 1 otherwise.
+ */
+int decoder_changed( decoder_t * decoder, const unsigned char * report, int length )
+{
+    if (length > HID_REPORT_MAX) length = HID_REPORT_MAX;
+
+    if (length == decoder->previous_length
+        && memcmp( decoder->previous, report, length ) == 0)
+    {
+        return 0;
+    }
+
+    memcpy( decoder->previous, report, length );
+    decoder->previous_length = length;
+
+    return 1;
+}
+
+
+/*
+ * Collects all the buttons of a report in one word, bit N being ButtonN.
+ */
+uint64_t decoder_buttons( decoder_t * decoder, const unsigned char * report, int length )
+{
+    uint64_t buttons = 0;
+
+    for(int i=0; i<decoder->lut_bytes; i++)
+    {
+        if (decoder->lut_offset[ i ] < length)
+        {
+            buttons |= decoder->lut[ i ][ report[ decoder->lut_offset[ i ] ] ];
+        }
+    }
+
+    return buttons;
+}
+
+
+/*
+ * Returns the 4D dial position, or -1 if the report is too short.
+ */
+int decoder_dial( const unsigned char * report, int length )
+{
+    return length > DECODER_DIAL_BYTE ? report[ DECODER_DIAL_BYTE ] : -1;
+}
+
+
+/*
+ * Stores the new button state.
+ *
+ * Returns a word with the bits set for all buttons that changed, to be
+ * walked with `decoder_next()`.
+ */
+uint64_t decoder_diff( decoder_t * decoder, uint64_t buttons )
+{
+    const uint64_t changed = decoder->buttons ^ buttons;
+    decoder->buttons = buttons;
+
+    return changed;
+}
+
+
+/*
+ * Sets or clears the bit of `button` in a report, the opposite of
+ * `decoder_buttons()`. Used to make up reports without a keyboard.
+ */
+void decoder_encode( unsigned char * report, int button, int pressed )
+{
+    if (button < 0 || button >= TOGGLE_BUTTON_TOTAL) return;
+
+    const decoder_bit_t * position = &report_layout[ button ];
+
+    if (pressed) report[ position->byte ] |= 1 << position->bit;
+    else report[ position->byte ] &= ~(1 << position->bit);
+}
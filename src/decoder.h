@@ -0,0 +1,74 @@
+#ifndef _DECODER_H_
+#define _DECODER_H_
+
+#include <string.h>
+#include <stdint.h>
+
+#include "hid.h"
+#include "button_names.h"
+
+// The size of the button report the A-series sends.
+#define DECODER_REPORT_SZ       30
+
+// The position of the 4D dial in the report.
+#define DECODER_DIAL_BYTE       28
+
+// The maximum number of distinct report bytes that can hold buttons.
+#define DECODER_MAX_BYTES       8
+
+// Every logical button gets one bit in a 64-bit state word.
+_Static_assert( TOGGLE_BUTTON_TOTAL <= 64, "the button state word is 64 bits" );
+
+/*
+ * Where a logical button lives in the report.
+ */
+typedef struct decoder_bit_t {
+    unsigned char byte;
+    unsigned char bit;
+} decoder_bit_t;
+
+/*
+ * Keeps the previous report around so a new report can be compared to
+ * it, and only the buttons that actually changed have to be visited.
+ */
+typedef struct decoder_t {
+    unsigned char previous[ HID_REPORT_MAX ];
+    int previous_length;
+
+    // The button bits as of the last call to `decoder_diff()`.
+    uint64_t buttons;
+
+    // For every report byte that holds buttons, the logical button
+    // bits for each of its 256 values. Built from the layout table by
+    // `decoder_init()`, so gathering the buttons costs one lookup per
+    // byte, however the bits are scattered over the report.
+    int lut_bytes;
+    unsigned char lut_offset[ DECODER_MAX_BYTES ];
+    uint64_t lut[ DECODER_MAX_BYTES ][ 256 ];
+} decoder_t;
+
+void decoder_init( decoder_t * decoder );
+
+int decoder_changed( decoder_t * decoder, const unsigned char * report, int length );
+
+uint64_t decoder_buttons( decoder_t * decoder, const unsigned char * report, int length );
+int decoder_dial( const unsigned char * report, int length );
+uint64_t decoder_diff( decoder_t * decoder, uint64_t buttons );
+
+void decoder_encode( unsigned char * report, int button, int pressed );
+
+
+/*
+ * Returns the lowest button number in `changed` and clears it, so
+ * visiting all changed buttons looks like:
+ *
+ *     while (changed) { int button = decoder_next( &changed ); ... }
+ */
+static inline int decoder_next( uint64_t * changed )
+{
+    const int button = __builtin_ctzll( *changed );
+    *changed &= *changed - 1;
+    return button;
+}
+
+#endif /* _DECODER_H_ */
@@ -0,0 +1,82 @@
+#include "dial.h"
+
+void dial_init( dial_t * dial )
+{
+    dial->position = -1;
+    dial->last_move = 0;
+}
+
+
+/*
+ * Takes the new dial position from a report.
+ *
+ * Returns the number of detents it moved since the previous report,
+ * positive when turned clockwise. Because the position wraps, anything
+ * more than half a turn is taken to be the other direction.
+ */
+int dial_update( dial_t * dial, int position )
+{
+    if (position < 0) return 0;
+
+    position &= DIAL_POSITIONS - 1;
+    if (dial->position == -1)
+    {
+        dial->position = position;
+        return 0;
+    }
+
+    int detents = (position - dial->position) & (DIAL_POSITIONS - 1);
+    if (detents >= DIAL_POSITIONS / 2)
+    {
+        detents -= DIAL_POSITIONS;
+    }
+
+    dial->position = position;
+    return detents;
+}
+
+
+/*
+ * Takes the acceleration curve and the maximum events per report from
+ * `mapping`.
+ */
+void dial_accel_compile( dial_accel_t * accel, const mapping_key_t * mapping )
+{
+    accel->length = mapping->accel_length;
+    memcpy( accel->steps, mapping->accel, sizeof(accel->steps) );
+    accel->max_events = mapping->max_events > 0 ? mapping->max_events : DIAL_MAX_EVENTS;
+}
+
+
+/*
+ * Works out how many times the mapping should be sent for `detents`
+ * moved at time `now`, using its acceleration curve and maximum events
+ * per report.
+ */
+int dial_steps( dial_t * dial, const dial_accel_t * accel, int detents, uint64_t now )
+{
+    const int count = abs( detents );
+    int factor = 1;
+
+    if (count == 0) return 0;
+
+    if (dial->last_move > 0 && now > dial->last_move)
+    {
+        // The time per detent since the previous movement.
+        const uint64_t millis = (now - dial->last_move) / 1000000ULL / count;
+
+        for(int i=0; i<accel->length; i++)
+        {
+            if (millis < accel->steps[i].millis && accel->steps[i].factor > factor)
+            {
+                factor = accel->steps[i].factor;
+            }
+        }
+    }
+
+    dial->last_move = now;
+
+    const int steps = count * factor;
+
+    return steps > accel->max_events ? accel->max_events : steps;
+}
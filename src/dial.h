@@ -0,0 +1,41 @@
+#ifndef _DIAL_H_
+#define _DIAL_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mapping.h"
+
+// The dial position is a nibble that wraps around.
+#define DIAL_POSITIONS          16
+
+// The most times a dial mapping is sent for a single report, unless the
+// mapping sets `max`. A fast flick is cut off here instead of flooding
+// uinput with key presses.
+#define DIAL_MAX_EVENTS         8
+
+/*
+ * The acceleration curve and the maximum events per report of a dial
+ * mapping, as `dial_steps()` needs them.
+ */
+typedef struct dial_accel_t {
+    unsigned char length;
+    accel_step_t steps[ MAX_ACCEL_STEPS ];
+    int max_events;
+} dial_accel_t;
+
+typedef struct dial_t {
+    // -1 until the first report.
+    int position;
+
+    // CLOCK_MONOTONIC nanoseconds of the previous movement.
+    uint64_t last_move;
+} dial_t;
+
+void dial_init( dial_t * dial );
+int dial_update( dial_t * dial, int position );
+void dial_accel_compile( dial_accel_t * accel, const mapping_key_t * mapping );
+int dial_steps( dial_t * dial, const dial_accel_t * accel, int detents, uint64_t now );
+
+#endif /* _DIAL_H_ */
@@ -0,0 +1,399 @@
+#include "dispatch.h"
+//#define KEYS_DEBUG
+//#define DUMP_KEYS_IN
+
+/*
+ * The input side: turns HID reports into output events for the output
+ * thread. Everything in here runs on the thread that reads the reports,
+ * with a `dispatch_t` for every keyboard.
+ */
+
+/*
+ * Helper that queues the key presses or releases, MMC commands and MIDI
+ * messages of an action for the output thread, as a single event.
+ *
+ * Returns -1 if the press was dropped (the ring is full), so its release
+ * mustn't be sent either, 0 otherwise.
+ */
+static int send_key_wrap( const action_t * action, int press, uint64_t timestamp )
+{
+    if (action_is_empty( action )) return 0;
+
+    return output_push_action( action, press, timestamp );
+}
+
+
+/*
+ * Queues the wheel movements of an action, `detents` times its scale.
+ */
+static void send_rel_wrap( const action_t * action, int detents, uint64_t timestamp )
+{
+    for(int ri = 0; ri < action->rel_count; ri++)
+    {
+        output_push_rel( action->rel[ri], detents * action->rel_scale, timestamp );
+    }
+}
+
+
+/*
+ * Switches the CCs of a toggling mapping on or off, for every press of
+ * the button. The rest of the mapping is sent by `send_key_wrap()`. If
+ * they are dropped it stays as it was, the next press sends the same
+ * values again.
+ */
+static void send_toggle( dispatch_t * dispatch, const action_t * action, int button_number, int layer, uint64_t timestamp )
+{
+    uint64_t * toggled = &dispatch->toggled[ layer ];
+
+    *toggled ^= 1ULL << button_number;
+    const int on = (*toggled >> button_number) & 1;
+
+    int dropped = 0;
+    for(int ki = 0; ki < action->toggle_count; ki++)
+    {
+        if (output_push_midi( MAPPING_TYPE_CC, action->toggle_cc[ki], on, timestamp ) < 0) dropped = 1;
+    }
+
+    if (dropped) *toggled ^= 1ULL << button_number;
+}
+
+
+/*
+ * Sends a mapping as a single press and release.
+ */
+static void send_tap( const action_t * action, uint64_t timestamp )
+{
+    if (send_key_wrap( action, 1, timestamp ) < 0) return;
+
+    send_rel_wrap( action, 1, timestamp );
+    send_key_wrap( action, 0, timestamp );
+}
+
+
+static int repeat_id( const dispatch_t * dispatch, int button_number )
+{
+    return dispatch->device * REAL_BUTTON_TOTAL + button_number;
+}
+
+
+static void on_repeat( int id, uint64_t timestamp, void * data )
+{
+    dispatch_t * dispatch = data;
+    const int button_number = id % REAL_BUTTON_TOTAL;
+
+    if (!dispatch->pressed[ button_number ]) return;
+
+    send_tap( dispatch->pressed[ button_number ], timestamp );
+
+    output_flush();
+}
+
+
+/*
+ * Switches the layers for a press or release of a layer button, and
+ * lights up the buttons of the new layer if that changed it.
+ */
+static void switch_layer( dispatch_t * dispatch, const action_t * action, int press, uint64_t timestamp )
+{
+    const int layer_key = action->layer_key;
+
+    if (action->latch)
+    {
+        // Every press latches it, or unlatches it again.
+        if (press) dispatch->latched = dispatch->latched == layer_key ? MAPPING_LAYER_NONE : layer_key;
+    }
+    else if (press)
+    {
+        dispatch->momentary[ layer_key ]++;
+    }
+    else if (dispatch->momentary[ layer_key ] > 0)
+    {
+        dispatch->momentary[ layer_key ]--;
+    }
+
+    int layer = dispatch->latched;
+    for(int l=MAPPING_LAYERS-1; l>MAPPING_LAYER_NONE; l--)
+    {
+        if (dispatch->momentary[ l ] > 0)
+        {
+            layer = l;
+            break;
+        }
+    }
+
+    if (layer == dispatch->layer) return;
+
+#ifdef KEYS_DEBUG
+    printf( "Layer changed: %d\n", layer );
+#endif
+
+    dispatch->layer = layer;
+
+    // The LED write is done on the output thread.
+    output_push( OUTPUT_LEDS, dispatch->device, layer, timestamp );
+}
+
+
+/*
+ * Resets the decoder, dial and layer state of a keyboard.
+ */
+void dispatch_init( dispatch_t * dispatch, int device, const action_table_t * actions )
+{
+    dispatch->device = device;
+    dispatch->actions = actions;
+
+    decoder_init( &dispatch->decoder );
+    dial_init( &dispatch->dial );
+    dispatch->layer = MAPPING_LAYER_NONE;
+    dispatch->latched = MAPPING_LAYER_NONE;
+    memset( dispatch->momentary, 0, sizeof(dispatch->momentary) );
+    memset( dispatch->pressed, 0, sizeof(dispatch->pressed) );
+    dispatch->sent = 0;
+    memset( dispatch->toggled, 0, sizeof(dispatch->toggled) );
+}
+
+
+/*
+ * Sends the release of every button that is held down, with what it
+ * did when it was pressed.
+ */
+static void release_pressed( dispatch_t * dispatch, uint64_t timestamp )
+{
+    for(int button_number=0; button_number<REAL_BUTTON_TOTAL; button_number++)
+    {
+        if (!dispatch->pressed[ button_number ]) continue;
+
+        repeat_stop( repeat_id( dispatch, button_number ) );
+        if ((dispatch->sent >> button_number) & 1) send_key_wrap( dispatch->pressed[ button_number ], 0, timestamp );
+        dispatch->pressed[ button_number ] = NULL;
+    }
+
+    dispatch->sent = 0;
+
+    output_flush();
+}
+
+
+/*
+ * Releases whatever is still held down and starts over, for when the
+ * keyboard went away. The dial position is forgotten as well, so the
+ * first report after it is back isn't taken as a turn. The latched
+ * layer and the toggles are kept.
+ */
+void dispatch_release( dispatch_t * dispatch, uint64_t timestamp )
+{
+    release_pressed( dispatch, timestamp );
+
+    uint64_t toggled[ MAPPING_LAYERS ];
+    memcpy( toggled, dispatch->toggled, sizeof(toggled) );
+    const int latched = dispatch->latched;
+
+    dispatch_init( dispatch, dispatch->device, dispatch->actions );
+
+    memcpy( dispatch->toggled, toggled, sizeof(toggled) );
+    dispatch->latched = latched;
+    dispatch->layer = latched;
+}
+
+
+/*
+ * Switches to the `actions` of a mapping that was read again, between
+ * two reports. Whatever is held down is released with what it did, and
+ * is then left alone until it is released (it isn't pressed again with
+ * its new mapping). The layers start over, the toggles are kept.
+ *
+ * The old actions have to stay around until the output thread is done
+ * with these releases.
+ */
+void dispatch_reload( dispatch_t * dispatch, const action_table_t * actions, uint64_t timestamp )
+{
+    release_pressed( dispatch, timestamp );
+
+    dispatch->actions = actions;
+    dispatch->layer = MAPPING_LAYER_NONE;
+    dispatch->latched = MAPPING_LAYER_NONE;
+    memset( dispatch->momentary, 0, sizeof(dispatch->momentary) );
+}
+
+
+/*
+ * Returns what a press of `button_number` does on the current layer,
+ * or for a release what it did when it was pressed (NULL if it was held
+ * before we knew about it).
+ */
+static const action_t * button_action( const dispatch_t * dispatch, int button_number, int pressed )
+{
+    // A press does what the button does on the current layer, and
+    // its release undoes exactly that, whatever the layer is now.
+    return pressed
+        ? action_get( dispatch->actions, dispatch->layer, button_number )
+        : dispatch->pressed[ button_number ];
+}
+
+
+/*
+ * Sends whatever a press or release of `button_number` does.
+ */
+static void dispatch_button( dispatch_t * dispatch, int button_number, int new_button_state, uint64_t timestamp )
+{
+    const action_t * action = button_action( dispatch, button_number, new_button_state );
+    const uint64_t bit = 1ULL << button_number;
+    const int sent = (dispatch->sent & bit) != 0;
+
+    if (!action) return; // it was held before we knew about it (or before a reload)
+
+    if (new_button_state)
+    {
+        dispatch->pressed[ button_number ] = action;
+    }
+    else
+    {
+        // Whatever it was pressed with, it doesn't repeat anymore.
+        repeat_stop( repeat_id( dispatch, button_number ) );
+        dispatch->pressed[ button_number ] = NULL;
+        dispatch->sent &= ~bit;
+    }
+
+    if (action->layer_key != MAPPING_LAYER_NONE)
+    {
+        switch_layer( dispatch, action, new_button_state, timestamp );
+    }
+
+    if (action->repeat_rate > 0)
+    {
+        // A repeating button is tapped rather than held down, so
+        // only this repeats it and not the desktop's key repeat.
+        if (new_button_state)
+        {
+            send_tap( action, timestamp );
+
+            repeat_start( repeat_id( dispatch, button_number ), action->repeat_delay * 1000000ULL,
+                1000000000ULL / action->repeat_rate, timestamp, on_repeat, dispatch );
+        }
+    }
+    else
+    {
+        if (action->toggle && new_button_state)
+        {
+            send_toggle( dispatch, action, button_number, dispatch->layer, timestamp );
+        }
+
+        if (new_button_state)
+        {
+            if (send_key_wrap( action, 1, timestamp ) == 0) dispatch->sent |= bit;
+
+            // A wheel moves a single detent for every press.
+            send_rel_wrap( action, 1, timestamp );
+        }
+        else if (sent)
+        {
+            send_key_wrap( action, 0, timestamp );
+        }
+    }
+}
+
+
+/*
+ * Handles a single HID report: tracks the layers, the 4D dial and the
+ * button presses and releases, and sends whatever is mapped.
+ *
+ * The `timestamp` is the CLOCK_MONOTONIC time the report came in.
+ */
+void dispatch_report( dispatch_t * dispatch, const unsigned char * keypress_buffer, int keypress_buffer_size, uint64_t timestamp )
+{
+#ifdef KEYS_DEBUG
+    printf( "read %d\n", keypress_buffer_size );
+#endif
+
+#ifdef DUMP_KEYS_IN
+    // 00000001
+    // 00000000     // these bytes identify the pressed/released key
+    // 00000000     // but the bit order is flipped.
+    // 00000000
+    // 00000000
+    // dump the buffer as binary
+    for(int b=0; b<keypress_buffer_size; b++)
+    {
+        printf( "%08b ", keypress_buffer[b] );
+        if ((b+1) % 8 == 0) printf( "\n" );
+    }
+    printf( "\n" );
+#endif
+
+    // Nothing to do if the report is the same as the previous one.
+    if (!decoder_changed( &dispatch->decoder, keypress_buffer, keypress_buffer_size ))
+    {
+        return;
+    }
+
+    // Determine the pressed keys. Multiple keys can be pressed
+    // at the same time.
+    const uint64_t key_value = decoder_buttons( &dispatch->decoder, keypress_buffer, keypress_buffer_size );
+
+#ifdef KEYS_DEBUG
+    printf( "key value: %010llx\n", (unsigned long long)key_value );
+#endif
+
+    // Only visit the buttons that actually changed, the layer buttons
+    // first so the layer they switch to applies to the whole report.
+    uint64_t changed = decoder_diff( &dispatch->decoder, key_value );
+    uint64_t rest = changed;
+    while (changed)
+    {
+        const int button_number = decoder_next( &changed );
+        const int new_button_state = (key_value >> button_number) & 1; // pressed or released
+        const action_t * action = button_action( dispatch, button_number, new_button_state );
+
+        if (action && action->layer_key != MAPPING_LAYER_NONE)
+        {
+            dispatch_button( dispatch, button_number, new_button_state, timestamp );
+            rest &= ~(1ULL << button_number);
+        }
+    }
+
+    const int dial_change = dial_update( &dispatch->dial, decoder_dial( keypress_buffer, keypress_buffer_size ) );
+    if (dial_change != 0)
+    {
+        // It actually changed, so we send a keydown / key up event
+        // for every detent (after acceleration, and up to a maximum).
+        // The dial does what it does without a layer, unless the
+        // layer maps it.
+        const int dial_index = dial_change > 0 ? DIAL_CW_INDEX : DIAL_CCW_INDEX;
+        const action_t * action = action_get( dispatch->actions, dispatch->layer, dial_index );
+        if (!action->mapped) action = action_get( dispatch->actions, MAPPING_LAYER_NONE, dial_index );
+
+        const int steps = dial_steps( &dispatch->dial, &action->accel, dial_change, timestamp );
+
+#ifdef KEYS_DEBUG
+        printf( "4D dial %+d, sending %d\n", dial_change, steps );
+#endif /* KEYS_DEBUG */
+
+        if (action->rel_count > 0)
+        {
+            // A wheel moves all the steps at once, with any keys
+            // (like a modifier) held down around it.
+            if (send_key_wrap( action, 1, timestamp ) == 0)
+            {
+                send_rel_wrap( action, dial_change > 0 ? steps : -steps, timestamp );
+                send_key_wrap( action, 0, timestamp );
+            }
+        }
+        else
+        {
+            for(int step = 0; step < steps; step++)
+            {
+                // We want to send this as a single keypress/release
+                // event, so first this, and release it...
+                if (send_key_wrap( action, 1, timestamp ) == 0) send_key_wrap( action, 0, timestamp );
+            }
+        }
+    }
+
+    while (rest)
+    {
+        const int button_number = decoder_next( &rest );
+        dispatch_button( dispatch, button_number, (key_value >> button_number) & 1, timestamp );
+    }
+
+    output_flush();
+}
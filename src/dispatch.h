@@ -0,0 +1,63 @@
+#ifndef _DISPATCH_H_
+#define _DISPATCH_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "button_names.h"
+#include "mapping.h"
+#include "action.h"
+#include "output.h"
+#include "decoder.h"
+#include "dial.h"
+#include "repeat.h"
+
+// The 4D dial position is the last thing we need from the
+// report, so a button report is at least this long.
+#define DISPATCH_REPORT_MIN_SZ  (DECODER_DIAL_BYTE + 1)
+
+/*
+ * The input state of a single keyboard.
+ */
+typedef struct dispatch_t {
+    // Which keyboard this is, passed on to the LED handler of the
+    // output thread.
+    int device;
+
+    // What the buttons of this keyboard do, compiled from its mapping.
+    const action_table_t * actions;
+
+    // Keeps track of the previous report and button state, so only
+    // the buttons that changed are looked at.
+    decoder_t decoder;
+
+    dial_t dial; // to determine the way the dial goes
+
+    // The layer the buttons are looked up on: the highest layer of the
+    // layer buttons that are held, or else the latched one.
+    int layer;
+    int latched;
+    unsigned char momentary[ MAPPING_LAYERS ]; // held buttons per layer
+
+    // What every held button did when it was pressed, so its release
+    // (and its repeats) pair with that whatever the layer is by then.
+    const action_t * pressed[ REAL_BUTTON_TOTAL ];
+
+    // The held buttons whose press made it into the output ring. Only
+    // those are released, as a release can't be dropped.
+    uint64_t sent;
+
+    // The toggling CC mappings that are switched on, on every layer.
+    // These outlive the keyboard going away, like the state of
+    // whatever they switched.
+    uint64_t toggled[ MAPPING_LAYERS ];
+} dispatch_t;
+
+void dispatch_init( dispatch_t * dispatch, int device, const action_table_t * actions );
+void dispatch_release( dispatch_t * dispatch, uint64_t timestamp );
+void dispatch_reload( dispatch_t * dispatch, const action_table_t * actions, uint64_t timestamp );
+void dispatch_report( dispatch_t * dispatch, const unsigned char * report, int length, uint64_t timestamp );
+
+#endif /* _DISPATCH_H_ */
@@ -0,0 +1,318 @@
+#include "event_loop.h"
+
+/*
+ * A small epoll based reactor. Everything the daemon reacts to (the HID
+ * device, signals, timers) is a file descriptor registered here, so the
+ * loop sleeps in `epoll_wait()` until one of those is actually ready and
+ * there are no periodic wake-ups when idle.
+ */
+
+// The epoll data holds both the slot and the fd, so events for a slot
+// that was re-used in the same batch can be recognised and ignored.
+#define EVLOOP_PACK(slot, fd)   (((uint64_t)(unsigned int)(fd) << 32) | (uint32_t)(slot))
+#define EVLOOP_SLOT(u64)        ((int)((u64) & 0xffffffff))
+#define EVLOOP_FD(u64)          ((int)((u64) >> 32))
+
+
+static evloop_source_t * evloop_find( evloop_t * loop, int fd )
+{
+    for(int i=0; i<EVLOOP_MAX_SOURCES; i++)
+    {
+        if (loop->sources[i].fd == fd)
+            return &loop->sources[i];
+    }
+
+    return NULL;
+}
+
+
+static void evloop_on_wakeup( int fd, unsigned int events, void * data )
+{
+    uint64_t value;
+    if (read( fd, &value, sizeof value ) < 0 && errno != EAGAIN)
+    {
+        perror( "evloop wakeup" );
+    }
+}
+
+
+static void evloop_on_signal( int fd, unsigned int events, void * data )
+{
+    evloop_t * loop = (evloop_t*)data;
+    struct signalfd_siginfo info;
+
+    if (read( fd, &info, sizeof info ) == sizeof info)
+    {
+        loop->running = 0;
+    }
+}
+
+
+/*
+ * Initialises the loop.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int evloop_init( evloop_t * loop )
+{
+    memset( loop, 0, sizeof(evloop_t) );
+
+    for(int i=0; i<EVLOOP_MAX_SOURCES; i++)
+    {
+        loop->sources[i].fd = -1;
+    }
+
+    loop->signal_fd = -1;
+    loop->wakeup_fd = -1;
+    loop->running = 1;
+
+    loop->epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+    if (loop->epoll_fd < 0) return -1;
+
+    loop->wakeup_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if (loop->wakeup_fd < 0
+        || evloop_add( loop, loop->wakeup_fd, EPOLLIN, evloop_on_wakeup, NULL ) < 0)
+    {
+        evloop_exit( loop );
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Closes the loop and the descriptors it owns. Descriptors that were
+ * added with `evloop_add()` are not closed, except for timers.
+ */
+void evloop_exit( evloop_t * loop )
+{
+    for(int i=0; i<EVLOOP_MAX_SOURCES; i++)
+    {
+        if (loop->sources[i].fd > -1 && loop->sources[i].is_timer)
+        {
+            close( loop->sources[i].fd );
+        }
+
+        loop->sources[i].fd = -1;
+    }
+
+    if (loop->signal_fd > -1) close( loop->signal_fd );
+    if (loop->wakeup_fd > -1) close( loop->wakeup_fd );
+    if (loop->epoll_fd > -1) close( loop->epoll_fd );
+
+    loop->signal_fd = -1;
+    loop->wakeup_fd = -1;
+    loop->epoll_fd = -1;
+}
+
+
+/*
+ * Blocks SIGINT, SIGTERM and SIGQUIT and has the loop stop when one of
+ * them arrives. This should be called before any thread is started so
+ * they all inherit the blocked signal mask.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int evloop_handle_signals( evloop_t * loop )
+{
+    sigset_t mask;
+    sigemptyset( &mask );
+    sigaddset( &mask, SIGINT );
+    sigaddset( &mask, SIGTERM );
+    sigaddset( &mask, SIGQUIT );
+
+    if (sigprocmask( SIG_BLOCK, &mask, NULL ) < 0) return -1;
+
+    loop->signal_fd = signalfd( -1, &mask, SFD_NONBLOCK | SFD_CLOEXEC );
+    if (loop->signal_fd < 0) return -1;
+
+    return evloop_add( loop, loop->signal_fd, EPOLLIN, evloop_on_signal, loop );
+}
+
+
+/*
+ * Watches `fd` for `events` (EPOLLIN, EPOLLOUT, ...) and calls `callback`
+ * whenever it is ready.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int evloop_add( evloop_t * loop, int fd, unsigned int events, evloop_callback_t callback, void * data )
+{
+    evloop_source_t * source = evloop_find( loop, -1 );
+    if (!source || fd < 0)
+    {
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof ev );
+    ev.events = events;
+    ev.data.u64 = EVLOOP_PACK( source - loop->sources, fd );
+
+    if (epoll_ctl( loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev ) < 0)
+    {
+        return -1;
+    }
+
+    source->fd = fd;
+    source->is_timer = 0;
+    source->callback = callback;
+    source->data = data;
+
+    return 0;
+}
+
+
+/*
+ * Stops watching `fd`. The descriptor itself is not closed.
+ */
+void evloop_remove( evloop_t * loop, int fd )
+{
+    evloop_source_t * source = evloop_find( loop, fd );
+    if (!source) return;
+
+    epoll_ctl( loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL );
+
+    source->fd = -1;
+    source->callback = NULL;
+    source->data = NULL;
+}
+
+
+/*
+ * Creates a (disarmed) CLOCK_MONOTONIC timer that calls `callback`
+ * when it expires. Use `evloop_timer_set()` to arm it.
+ *
+ * Returns the timer descriptor, or -1 on error.
+ */
+int evloop_timer_new( evloop_t * loop, evloop_callback_t callback, void * data )
+{
+    int fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+    if (fd < 0) return -1;
+
+    if (evloop_add( loop, fd, EPOLLIN, callback, data ) < 0)
+    {
+        close( fd );
+        return -1;
+    }
+
+    evloop_find( loop, fd )->is_timer = 1;
+    return fd;
+}
+
+
+/*
+ * (Re-)arms a timer. An `initial_millis` of 0 disarms it, an
+ * `interval_millis` of 0 makes it fire only once.
+ */
+int evloop_timer_set( int timer_fd, long initial_millis, long interval_millis )
+{
+    struct itimerspec spec;
+    memset( &spec, 0, sizeof spec );
+
+    spec.it_value.tv_sec = initial_millis / 1000;
+    spec.it_value.tv_nsec = (initial_millis % 1000) * 1000000L;
+    spec.it_interval.tv_sec = interval_millis / 1000;
+    spec.it_interval.tv_nsec = (interval_millis % 1000) * 1000000L;
+
+    return timerfd_settime( timer_fd, 0, &spec, NULL );
+}
+
+
+/*
+ * Arms a timer to fire once at `timestamp` (CLOCK_MONOTONIC nanoseconds,
+ * see `evloop_now()`). A time in the past fires right away.
+ */
+int evloop_timer_set_at( int timer_fd, uint64_t timestamp )
+{
+    struct itimerspec spec;
+    memset( &spec, 0, sizeof spec );
+
+    // A zero value would disarm the timer.
+    if (timestamp == 0) timestamp = 1;
+
+    spec.it_value.tv_sec = timestamp / 1000000000ULL;
+    spec.it_value.tv_nsec = timestamp % 1000000000ULL;
+
+    return timerfd_settime( timer_fd, TFD_TIMER_ABSTIME, &spec, NULL );
+}
+
+
+/*
+ * Removes the timer from the loop and closes it.
+ */
+void evloop_timer_free( evloop_t * loop, int timer_fd )
+{
+    if (timer_fd < 0) return;
+
+    evloop_remove( loop, timer_fd );
+    close( timer_fd );
+}
+
+
+/*
+ * Returns the CLOCK_MONOTONIC time in nanoseconds, the clock the
+ * timers run on.
+ */
+uint64_t evloop_now()
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+/*
+ * Runs the loop until `evloop_stop()` is called or one of the handled
+ * signals arrives.
+ */
+void evloop_run( evloop_t * loop )
+{
+    struct epoll_event events[ EVLOOP_MAX_EVENTS ];
+
+    while (loop->running)
+    {
+        int ready = epoll_wait( loop->epoll_fd, events, EVLOOP_MAX_EVENTS, -1 );
+        if (ready < 0)
+        {
+            if (errno == EINTR) continue;
+
+            perror( "epoll_wait" );
+            break;
+        }
+
+        for(int i=0; i<ready && loop->running; i++)
+        {
+            const int fd = EVLOOP_FD( events[i].data.u64 );
+            evloop_source_t * source = &loop->sources[ EVLOOP_SLOT( events[i].data.u64 ) ];
+
+            // Removed (or replaced) by an earlier callback in this batch.
+            if (source->fd != fd || !source->callback) continue;
+
+            if (source->is_timer)
+            {
+                uint64_t expirations;
+                if (read( fd, &expirations, sizeof expirations ) < 0) continue;
+            }
+
+            source->callback( fd, events[i].events, source->data );
+        }
+    }
+}
+
+
+/*
+ * Makes `evloop_run()` return. This is safe to call from another thread.
+ */
+void evloop_stop( evloop_t * loop )
+{
+    const uint64_t one = 1;
+
+    loop->running = 0;
+    if (loop->wakeup_fd > -1 && write( loop->wakeup_fd, &one, sizeof one ) < 0)
+    {
+        perror( "evloop stop" );
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+// The maximum number of file descriptors a single loop can watch.
+#define EVLOOP_MAX_SOURCES      32
+
+// How many ready descriptors are handled per `epoll_wait()`.
+#define EVLOOP_MAX_EVENTS       16
+
+/*
+ * Called when `fd` is ready. `events` is the EPOLL* mask that
+ * was reported.
+ */
+typedef void (*evloop_callback_t)( int fd, unsigned int events, void * data );
+
+typedef struct evloop_source_t {
+    int fd;
+
+    // Timers have their expiration count read by the loop
+    // before the callback is invoked.
+    int is_timer;
+
+    evloop_callback_t callback;
+    void * data;
+} evloop_source_t;
+
+typedef struct evloop_t {
+    int epoll_fd;
+
+    // Used to wake up the loop from another thread (`evloop_stop`).
+    int wakeup_fd;
+
+    // -1 unless `evloop_handle_signals()` was called.
+    int signal_fd;
+
+    _Atomic int running;
+
+    evloop_source_t sources[ EVLOOP_MAX_SOURCES ];
+} evloop_t;
+
+int evloop_init( evloop_t * loop );
+void evloop_exit( evloop_t * loop );
+
+int evloop_handle_signals( evloop_t * loop );
+
+int evloop_add( evloop_t * loop, int fd, unsigned int events, evloop_callback_t callback, void * data );
+void evloop_remove( evloop_t * loop, int fd );
+
+int evloop_timer_new( evloop_t * loop, evloop_callback_t callback, void * data );
+int evloop_timer_set( int timer_fd, long initial_millis, long interval_millis );
+int evloop_timer_set_at( int timer_fd, uint64_t timestamp );
+void evloop_timer_free( evloop_t * loop, int timer_fd );
+
+uint64_t evloop_now();
+
+void evloop_run( evloop_t * loop );
+void evloop_stop( evloop_t * loop );
+
+#endif /* _EVENT_LOOP_H_ */
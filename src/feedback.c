@@ -0,0 +1,158 @@
+#include "feedback.h"
+
+/*
+ * Lights up the buttons for what the software is doing. A button follows
+ * the MMC command or MIDI message it sends itself (or the one of its
+ * `led` option): a CC or note is lit while it is on, a program change
+ * while that program is selected on its channel and an MMC command while
+ * the transport is doing it.
+ */
+
+// Only one of these at a time. Both plays light up both, as either
+// means the transport is playing.
+#define MMC_PLAYING     ((1 << MMC_PLAY) | (1 << MMC_DEFERRED_PLAY))
+#define MMC_TRANSPORT   ((1 << MMC_STOP) | (1 << MMC_PAUSE) | MMC_PLAYING | (1 << MMC_FORWARD) | (1 << MMC_REWIND))
+#define MMC_RECORDING   ((1 << MMC_RECORD_STROBE) | (1 << MMC_RECORD_PAUSE))
+
+
+void feedback_init( feedback_t * feedback )
+{
+    for(int layer=0; layer<MAPPING_LAYERS; layer++)
+    {
+        atomic_store( &feedback->lit[ layer ], 0 );
+    }
+    feedback->mmc_state = 0;
+}
+
+
+/*
+ * Returns what the software sends about `key`, or NULL if there is
+ * nothing it could send.
+ */
+static const mapped_key_t * feedback_source( const mapping_key_t * key )
+{
+    if (key->led.type != MAPPING_TYPE_KEY) return &key->led;
+
+    for(int i=0; i<key->length; i++)
+    {
+        if (key->keys[i].type != MAPPING_TYPE_KEY && key->keys[i].type != MAPPING_TYPE_REL)
+        {
+            return &key->keys[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Tracks the transport from the MMC commands that come in: STOP, PAUSE,
+ * PLAY, DEFERRED PLAY, FAST FORWARD and REWIND for what it does, and
+ * RECORD STROBE, RECORD PAUSE and RECORD EXIT for the recording. A
+ * STOP, PAUSE or (deferred) PLAY also ends the recording, the way the
+ * software does when it sends one of those while it records.
+ */
+static void feedback_mmc( feedback_t * feedback, int command )
+{
+    switch (command)
+    {
+        case MMC_STOP:
+        case MMC_PAUSE:
+            feedback->mmc_state = 1 << command;
+            break;
+
+        case MMC_PLAY:
+        case MMC_DEFERRED_PLAY:
+            feedback->mmc_state = MMC_PLAYING;
+            break;
+
+        case MMC_FORWARD:
+        case MMC_REWIND:
+            feedback->mmc_state = (feedback->mmc_state & ~MMC_TRANSPORT) | (1 << command);
+            break;
+
+        case MMC_RECORD_STROBE:
+        case MMC_RECORD_PAUSE:
+            feedback->mmc_state = (feedback->mmc_state & ~MMC_RECORDING) | (1 << command);
+            break;
+
+        case MMC_RECORD_EXIT:
+            feedback->mmc_state &= ~MMC_RECORDING;
+            break;
+    }
+}
+
+
+/*
+ * Returns 1 if `message` lights up the button of `source`, 0 if it puts
+ * it out or -1 if it is about something else.
+ */
+static int feedback_match( const feedback_t * feedback, const mapped_key_t * source, mapped_key_t message )
+{
+    if (source->type != message.type) return -1;
+
+    if (message.type == MAPPING_TYPE_MMC)
+    {
+        return (feedback->mmc_state >> source->key) & 1;
+    }
+
+    if (MIDI_CHANNEL( source->key ) != MIDI_CHANNEL( message.key )) return -1;
+
+    if (message.type == MAPPING_TYPE_PC)
+    {
+        return MIDI_NUMBER( source->key ) == MIDI_NUMBER( message.key );
+    }
+
+    if (MIDI_NUMBER( source->key ) != MIDI_NUMBER( message.key )) return -1;
+
+    return MIDI_VALUE( message.key ) > 0;
+}
+
+
+/*
+ * Handles a message from the software for the buttons of `mapping`.
+ *
+ * Returns 1 if that changed which buttons are lit, 0 otherwise.
+ */
+int feedback_update( feedback_t * feedback, const mapping_t * mapping, mapped_key_t message )
+{
+    int changed = 0;
+
+    if (message.type == MAPPING_TYPE_MMC) feedback_mmc( feedback, message.key );
+
+    for(int layer=0; layer<MAPPING_LAYERS; layer++)
+    {
+        const uint64_t before = atomic_load( &feedback->lit[ layer ] );
+        uint64_t lit = before;
+
+        for(int i=0; i<TOTAL_HID_BUTTONS; i++)
+        {
+            const mapped_key_t * source = feedback_source( mapping_get( mapping, layer, i ) );
+            if (!source) continue;
+
+            const int state = feedback_match( feedback, source, message );
+            if (state == 1) lit |= 1ULL << i;
+            else if (state == 0) lit &= ~(1ULL << i);
+        }
+
+        if (lit != before)
+        {
+            atomic_store( &feedback->lit[ layer ], lit );
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+
+/*
+ * @returns 1 if the software lit up the button at `index`, 0 otherwise.
+ */
+int feedback_is_lit( feedback_t * feedback, int index, int layer )
+{
+    if (index < 0 || index >= TOTAL_HID_BUTTONS) return 0;
+    if (layer < 0 || layer >= MAPPING_LAYERS) return 0;
+
+    return (atomic_load( &feedback->lit[ layer ] ) >> index) & 1;
+}
@@ -0,0 +1,30 @@
+#ifndef _FEEDBACK_H_
+#define _FEEDBACK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "mapping.h"
+#include "mmc_stuff.h"
+#include "button_leds.h"
+
+/*
+ * What the software told us about the buttons of a keyboard, through
+ * the ALSA input port.
+ */
+typedef struct feedback_t {
+    // The buttons it lit up, on every layer. These are set on
+    // the event loop and read by the output thread when it lights
+    // up the buttons.
+    _Atomic uint64_t lit[ MAPPING_LAYERS ];
+
+    // The MMC commands the transport is doing, a bit per command.
+    unsigned int mmc_state;
+} feedback_t;
+
+void feedback_init( feedback_t * feedback );
+int feedback_update( feedback_t * feedback, const mapping_t * mapping, mapped_key_t message );
+int feedback_is_lit( feedback_t * feedback, int index, int layer );
+
+#endif /* _FEEDBACK_H_ */
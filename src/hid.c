@@ -1,107 +1,187 @@
-#include "hid.h"
-// #define HID_DEBUG 
+#include "hid_backend.h"
+// #define HID_DEBUG
 
-static hid_device * device = NULL;
+#ifdef WITH_HIDAPI
+static const hid_backend_t * backend = &hid_backend_hidapi;
+#else
+static const hid_backend_t * backend = &hid_backend_hidraw;
+#endif
 
-/* 
- * Initialise HID device.
- * 
- * Returns -1 on error, 0 if all is well.
+// Which device numbers are in use.
+static int opened[ HID_MAX_DEVICES ];
+
+// The LEDs are written from the output thread, while the main thread
+// may be closing or reopening the device.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Selects the backend by name ("hidapi" or "hidraw"). This has to be
+ * called before the first `hidstuff_init()`.
+ *
+ * Returns -1 if the backend is unknown (or not compiled in), 0 otherwise.
  */
-int hidstuff_init(int vid, int pid)
+int hidstuff_set_backend( const char * name )
 {
-    hid_init();
-    
-    device =  hid_open( vid, pid, NULL );
-    if (!device) return -1;
-    
-    // set the device to blocking while waiting so
-    // we don't have to poll it.
-    hid_set_nonblocking( device, 0 );
-    
-    return 0;
+#ifdef WITH_HIDAPI
+    if (strcasecmp( name, hid_backend_hidapi.name ) == 0)
+    {
+        backend = &hid_backend_hidapi;
+        return 0;
+    }
+#endif
+
+    if (strcasecmp( name, hid_backend_hidraw.name ) == 0)
+    {
+        backend = &hid_backend_hidraw;
+        return 0;
+    }
+
+    return -1;
 }
 
 
-/* 
- * Cleans up HID device.
+const char * hidstuff_backend_name()
+{
+    return backend->name;
+}
+
+
+/*
+ * Opens a HID device. Calling it again with the same `vid` and `pid`
+ * opens the next keyboard of the same model.
+ *
+ * Returns -1 on error, the device number otherwise.
  */
-void hidstuff_exit()
+int hidstuff_init(int vid, int pid)
 {
-    if (device) hid_close(device);
-    device = NULL;
-    
-    hid_exit();
+    int device = 0;
+    while (device < HID_MAX_DEVICES && opened[ device ]) device++;
+
+    if (device == HID_MAX_DEVICES) return -1;
+
+    return hidstuff_reopen( device, vid, pid ) < 0 ? -1 : device;
 }
 
 
-/* 
- * Attempts to read data from HID device.
- * 
- * Returns -1 on error, the number of bytes otherwise (which could be 0).
+/*
+ * Opens a HID device under a number that was used before, e.g. when the
+ * keyboard is plugged back in.
+ *
+ * Returns -1 on error, 0 if all is well.
  */
-int hidstuff_read_raw( void* receive_buffer, size_t receive_buflen, int blocking )
+int hidstuff_reopen( int device, int vid, int pid )
 {
-    if (!device)
+    int result = -1;
+
+    if (device < 0 || device >= HID_MAX_DEVICES) return -1;
+
+    pthread_mutex_lock( &lock );
+    if (!opened[ device ] && backend->init( device, vid, pid ) == 0)
     {
-        return -1;
+        opened[ device ] = 1;
+        result = 0;
     }
-    
-    if (blocking) {
-        hid_set_nonblocking( device, 0 );
-    } else {
-        hid_set_nonblocking( device, 1 );
+    pthread_mutex_unlock( &lock );
+
+    return result;
+}
+
+
+static int hidstuff_is_open( int device )
+{
+    return device >= 0 && device < HID_MAX_DEVICES && opened[ device ];
+}
+
+
+/*
+ * Closes a single HID device.
+ */
+void hidstuff_close( int device )
+{
+    if (!hidstuff_is_open( device )) return;
+
+    pthread_mutex_lock( &lock );
+    backend->close( device );
+    opened[ device ] = 0;
+    pthread_mutex_unlock( &lock );
+}
+
+
+/*
+ * Closes all HID devices and cleans up.
+ */
+void hidstuff_exit()
+{
+    for(int device=0; device<HID_MAX_DEVICES; device++)
+    {
+        hidstuff_close( device );
     }
-    
-    return hid_read( device, receive_buffer, receive_buflen );
+
+    backend->exit();
 }
 
 
-/* 
- * Attempts to read data from HID device but times out after the requested
- * millis.
- * 
- * Returns -1 on error, the number of bytes otherwise (which could be 0).
+/*
+ * Returns a descriptor that becomes readable when a report is available,
+ * so it can be added to the event loop. Use `hidstuff_read_raw()` in
+ * non-blocking mode to fetch the reports.
+ *
+ * Returns -1 on error.
  */
-int hidstuff_read_raw_timeout( void * receive_buffer, size_t receive_buflen, int millis )
+int hidstuff_get_fd( int device )
 {
-    if (!device) return -1;
-    
-    // always do this in blocking mode?
-    hid_set_nonblocking( device, 0 );
-    return hid_read_timeout( device, receive_buffer, receive_buflen, millis );
+    if (!hidstuff_is_open( device )) return -1;
+
+    return backend->get_fd( device );
 }
 
 
+/*
+ * Attempts to read data from HID device.
+ *
+ * Returns -1 on error, the number of bytes otherwise (which could be 0).
+ */
+int hidstuff_read_raw( int device, void* receive_buffer, size_t receive_buflen, int blocking )
+{
+    if (!hidstuff_is_open( device ))
+    {
+        return -1;
+    }
+
+    return backend->read( device, receive_buffer, receive_buflen, blocking ? -1 : 0 );
+}
+
 
-/* 
+/*
  * Send raw USB HID payload to the specified device and, if receive_buflen is non-zero
  * waits for a result.
  */
-int hidstuff_send_raw( 
+int hidstuff_send_raw( int device,
     unsigned char * buffer, size_t buflen,
     void* receive_buffer, size_t receive_buflen )
 {
-    if (!device)
+    if (device < 0 || device >= HID_MAX_DEVICES)
     {
         return -1;
     }
-    
+
 #ifdef HID_DEBUG
     printf( "send_raw (write %d, read %d)\n", buflen, receive_buflen );
 #endif
-    int result = hid_write( device, buffer, buflen );
+    pthread_mutex_lock( &lock );
+    int result = opened[ device ] ? backend->write( device, buffer, buflen ) : -1;
+    pthread_mutex_unlock( &lock );
 
-    if (receive_buffer && receive_buflen > 0) 
+    if (receive_buffer && receive_buflen > 0)
     {
 #ifdef HID_DEBUG
         printf( "read from %d\n", __LINE__ );
 #endif
-        
+
         // always read blocking, I guess?
-        hidstuff_read_raw( receive_buffer, receive_buflen, 1 );
+        hidstuff_read_raw( device, receive_buffer, receive_buflen, 1 );
     }
-    
+
     return result;
 }
- 
@@ -5,17 +5,35 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
 
-#include <hidapi/hidapi.h>
+// The largest report the A-series sends is 30 bytes, this leaves
+// some room for other hardware.
+#define HID_REPORT_MAX          64
+
+// The reader gives up after this many consecutive failed reads.
+#define HID_MAX_READ_ERRORS     10
+
+// The most keyboards that can be open at the same time.
+#define HID_MAX_DEVICES         4
+
+int hidstuff_set_backend( const char * name );
+const char * hidstuff_backend_name();
 
 int hidstuff_init( int vid, int pid );
+int hidstuff_reopen( int device, int vid, int pid );
+void hidstuff_close( int device );
 void hidstuff_exit();
 
-int hidstuff_send_raw( 
+int hidstuff_get_fd( int device );
+
+int hidstuff_send_raw( int device,
     unsigned char * buffer, size_t buflen,
     void * receive_buffer, size_t receive_buflen );
 
-int hidstuff_read_raw( void * receive_buffer, size_t receive_buflen, int blocking );
-int hidstuff_read_raw_timeout( void * receive_buffer, size_t receive_buflen, int millis );
+int hidstuff_read_raw( int device, void * receive_buffer, size_t receive_buflen, int blocking );
 
 #endif /* _HID_STUFF_H_ */
@@ -0,0 +1,38 @@
+#ifndef _HID_BACKEND_H_
+#define _HID_BACKEND_H_
+
+#include "hid.h"
+
+/*
+ * The operations a HID backend implements. The `hidstuff_*` functions
+ * forward to whichever backend was selected. Every open device has a
+ * number below HID_MAX_DEVICES, which the backend keeps its state under.
+ */
+typedef struct hid_backend_t {
+    const char * name;
+
+    // Opens the first device that matches `vid` and `pid` and is not
+    // open under another number yet, so identical keyboards each get
+    // one. Returns -1 on error, 0 if all is well.
+    int (*init)( int device, int vid, int pid );
+    void (*close)( int device );
+
+    // Cleans up after the last device has been closed.
+    void (*exit)();
+
+    // Returns a descriptor that can be polled for reports.
+    int (*get_fd)( int device );
+
+    // Waits at most `millis` for a report (-1 waits forever, 0 does
+    // not wait). Returns -1 on error, the number of bytes otherwise.
+    int (*read)( int device, void * receive_buffer, size_t receive_buflen, int millis );
+    int (*write)( int device, const unsigned char * buffer, size_t buflen );
+} hid_backend_t;
+
+#ifdef WITH_HIDAPI
+extern const hid_backend_t hid_backend_hidapi;
+#endif
+
+extern const hid_backend_t hid_backend_hidraw;
+
+#endif /* _HID_BACKEND_H_ */
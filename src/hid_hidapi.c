@@ -0,0 +1,234 @@
+#include "hid_backend.h"
+
+#ifdef WITH_HIDAPI
+
+#include <hidapi/hidapi.h>
+
+/*
+ * hidapi-libusb does not expose a pollable descriptor, so reports are
+ * forwarded from a reader thread over a socket pair (which keeps the
+ * report boundaries intact) and the read end is handed to the event loop.
+ * Every open device has its own reader thread.
+ */
+typedef struct hidapi_device_t {
+    hid_device * device;
+    char * path;
+
+    int forward_fds[2];
+    pthread_t forward_thread;
+    int forwarding;
+} hidapi_device_t;
+
+static hidapi_device_t devices[ HID_MAX_DEVICES ];
+static int initialised = 0;
+
+
+/*
+ * Returns 1 if `path` is already open under another device number.
+ */
+static int hidapi_in_use( const char * path )
+{
+    for(int device=0; device<HID_MAX_DEVICES; device++)
+    {
+        if (devices[ device ].path && strcmp( devices[ device ].path, path ) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Opens the first device that matches `vid` and `pid` and isn't open yet.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+static int hidapi_init( int device, int vid, int pid )
+{
+    hidapi_device_t * slot = &devices[ device ];
+
+    if (!initialised)
+    {
+        hid_init();
+        initialised = 1;
+    }
+
+    memset( slot, 0, sizeof(hidapi_device_t) );
+    slot->forward_fds[0] = slot->forward_fds[1] = -1;
+
+    struct hid_device_info * found = hid_enumerate( vid, pid );
+    for(struct hid_device_info * info = found; info; info = info->next)
+    {
+        if (hidapi_in_use( info->path )) continue;
+
+        slot->device = hid_open_path( info->path );
+        if (slot->device)
+        {
+            slot->path = strdup( info->path );
+            break;
+        }
+    }
+    hid_free_enumeration( found );
+
+    if (!slot->device) return -1;
+
+    // set the device to blocking while waiting so
+    // we don't have to poll it.
+    hid_set_nonblocking( slot->device, 0 );
+
+    return 0;
+}
+
+
+static void hidapi_close( int device )
+{
+    hidapi_device_t * slot = &devices[ device ];
+
+    if (slot->forwarding)
+    {
+        // `hid_read()` waits on a condition variable with a clean-up
+        // handler installed, so the reader thread can be cancelled.
+        pthread_cancel( slot->forward_thread );
+        pthread_join( slot->forward_thread, NULL );
+        slot->forwarding = 0;
+    }
+
+    if (slot->forward_fds[0] > -1) close( slot->forward_fds[0] );
+    if (slot->forward_fds[1] > -1) close( slot->forward_fds[1] );
+    slot->forward_fds[0] = slot->forward_fds[1] = -1;
+
+    if (slot->device) hid_close( slot->device );
+    slot->device = NULL;
+
+    free( slot->path );
+    slot->path = NULL;
+}
+
+
+static void hidapi_exit()
+{
+    if (initialised) hid_exit();
+    initialised = 0;
+}
+
+
+/*
+ * The reader thread that blocks in `hid_read()` and forwards every report
+ * to the event loop. If the device keeps failing the write end is closed,
+ * which the reading side sees as a hang-up.
+ */
+static void * hidapi_forward( void * arg )
+{
+    hidapi_device_t * slot = arg;
+    unsigned char buffer[ HID_REPORT_MAX ];
+    int read_errors = 0;
+
+    while (read_errors <= HID_MAX_READ_ERRORS)
+    {
+        int result = hid_read( slot->device, buffer, sizeof buffer );
+        if (result < 0)
+        {
+            read_errors++;
+            continue;
+        }
+
+        read_errors = 0;
+        if (result > 0 && send( slot->forward_fds[1], buffer, result, MSG_NOSIGNAL ) < 0)
+        {
+            break;
+        }
+    }
+
+    shutdown( slot->forward_fds[1], SHUT_WR );
+    return NULL;
+}
+
+
+static int hidapi_get_fd( int device )
+{
+    hidapi_device_t * slot = &devices[ device ];
+
+    if (!slot->device) return -1;
+    if (slot->forwarding) return slot->forward_fds[0];
+
+    if (socketpair( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, slot->forward_fds ) < 0)
+    {
+        return -1;
+    }
+
+    hid_set_nonblocking( slot->device, 0 );
+    if (pthread_create( &slot->forward_thread, NULL, hidapi_forward, slot ) != 0)
+    {
+        close( slot->forward_fds[0] );
+        close( slot->forward_fds[1] );
+        slot->forward_fds[0] = slot->forward_fds[1] = -1;
+        return -1;
+    }
+
+    slot->forwarding = 1;
+    return slot->forward_fds[0];
+}
+
+
+/*
+ * Reads a forwarded report, waiting at most `millis` (-1 waits forever).
+ *
+ * Returns -1 on error or hang-up, the number of bytes otherwise.
+ */
+static int hidapi_read_forwarded( hidapi_device_t * slot, void * receive_buffer, size_t receive_buflen, int millis )
+{
+    struct pollfd pfd = { .fd = slot->forward_fds[0], .events = POLLIN };
+    if (millis != 0)
+    {
+        int ready = poll( &pfd, 1, millis );
+        if (ready < 0) return -1;
+        if (ready == 0) return 0;
+    }
+
+    ssize_t result = recv( slot->forward_fds[0], receive_buffer, receive_buflen, MSG_DONTWAIT );
+    if (result < 0)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+
+    // An empty read means the reader thread gave up.
+    return result == 0 ? -1 : (int)result;
+}
+
+
+static int hidapi_read( int device, void * receive_buffer, size_t receive_buflen, int millis )
+{
+    hidapi_device_t * slot = &devices[ device ];
+
+    if (!slot->device) return -1;
+
+    if (slot->forwarding)
+    {
+        return hidapi_read_forwarded( slot, receive_buffer, receive_buflen, millis );
+    }
+
+    return hid_read_timeout( slot->device, receive_buffer, receive_buflen, millis );
+}
+
+
+static int hidapi_write( int device, const unsigned char * buffer, size_t buflen )
+{
+    if (!devices[ device ].device) return -1;
+
+    return hid_write( devices[ device ].device, buffer, buflen );
+}
+
+
+const hid_backend_t hid_backend_hidapi = {
+    .name = "hidapi",
+    .init = hidapi_init,
+    .close = hidapi_close,
+    .exit = hidapi_exit,
+    .get_fd = hidapi_get_fd,
+    .read = hidapi_read,
+    .write = hidapi_write
+};
+
+#endif /* WITH_HIDAPI */
@@ -0,0 +1,203 @@
+#include "hid_backend.h"
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <linux/limits.h>
+
+/*
+ * The native backend talks to the kernel's hidraw driver directly, so a
+ * report goes from the interrupt endpoint to our `read()` without the
+ * libusb transfer thread and hidapi's report queue in between.
+ */
+
+#define HIDRAW_SYSFS_PATH   "/sys/class/hidraw"
+
+// How long a write waits for a busy endpoint, a keyboard that takes
+// longer is taken as gone (rather than holding up every other one).
+#define HIDRAW_WRITE_TIMEOUT_MS     100
+
+typedef struct hidraw_device_t {
+    int fd;
+    char path[ PATH_MAX ];
+} hidraw_device_t;
+
+// Only the ones with a `path` are open.
+static hidraw_device_t devices[ HID_MAX_DEVICES ];
+
+
+/*
+ * Checks the `HID_ID=<bus>:<vendor>:<product>` line in the uevent file
+ * of /sys/class/hidraw/<name>/device.
+ *
+ * Returns 1 if it matches, 0 otherwise.
+ */
+static int hidraw_matches( const char * name, int vid, int pid )
+{
+    char path[ PATH_MAX ];
+    char line[ 256 ];
+    int matches = 0;
+
+    snprintf( path, sizeof path, HIDRAW_SYSFS_PATH "/%s/device/uevent", name );
+
+    FILE * uevent = fopen( path, "r" );
+    if (!uevent) return 0;
+
+    while (fgets( line, sizeof line, uevent ))
+    {
+        unsigned int bus, found_vid, found_pid;
+        if (sscanf( line, "HID_ID=%x:%x:%x", &bus, &found_vid, &found_pid ) == 3)
+        {
+            matches = (found_vid == (unsigned int)vid && found_pid == (unsigned int)pid) ? 1 : 0;
+            break;
+        }
+    }
+
+    fclose( uevent );
+    return matches;
+}
+
+
+/*
+ * Returns 1 if `path` is already open under another device number.
+ */
+static int hidraw_in_use( const char * path )
+{
+    for(int device=0; device<HID_MAX_DEVICES; device++)
+    {
+        if (strcmp( devices[ device ].path, path ) == 0) return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Looks up the first /dev/hidrawN that belongs to `vid` and `pid` and
+ * isn't open yet, and opens it.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+static int hidraw_init( int device, int vid, int pid )
+{
+    hidraw_device_t * slot = &devices[ device ];
+
+    slot->fd = -1;
+    slot->path[0] = 0;
+
+    DIR * dir = opendir( HIDRAW_SYSFS_PATH );
+    if (!dir) return -1;
+
+    struct dirent * entry;
+    while ((entry = readdir( dir )) != NULL)
+    {
+        if (strncmp( entry->d_name, "hidraw", 6 ) != 0) continue;
+
+        if (hidraw_matches( entry->d_name, vid, pid ))
+        {
+            char path[ PATH_MAX ];
+            snprintf( path, sizeof path, "/dev/%s", entry->d_name );
+
+            if (hidraw_in_use( path )) continue;
+
+            slot->fd = open( path, O_RDWR | O_NONBLOCK | O_CLOEXEC );
+            if (slot->fd < 0)
+            {
+                perror( path );
+            }
+            else
+            {
+                strcpy( slot->path, path );
+            }
+            break;
+        }
+    }
+
+    closedir( dir );
+    return slot->fd < 0 ? -1 : 0;
+}
+
+
+static void hidraw_close( int device )
+{
+    if (devices[ device ].fd > -1) close( devices[ device ].fd );
+    devices[ device ].fd = -1;
+    devices[ device ].path[0] = 0;
+}
+
+
+static void hidraw_exit()
+{
+}
+
+
+static int hidraw_get_fd( int device )
+{
+    return devices[ device ].fd;
+}
+
+
+static int hidraw_read( int device, void * receive_buffer, size_t receive_buflen, int millis )
+{
+    const int device_fd = devices[ device ].fd;
+    if (device_fd < 0) return -1;
+
+    if (millis != 0)
+    {
+        struct pollfd pfd = { .fd = device_fd, .events = POLLIN };
+
+        int ready = poll( &pfd, 1, millis );
+        if (ready < 0) return -1;
+        if (ready == 0) return 0;
+    }
+
+    ssize_t result = read( device_fd, receive_buffer, receive_buflen );
+    if (result < 0)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+
+    return (int)result;
+}
+
+
+/*
+ * The first byte is the report id, same as with hidapi.
+ */
+static int hidraw_write( int device, const unsigned char * buffer, size_t buflen )
+{
+    const int device_fd = devices[ device ].fd;
+    if (device_fd < 0) return -1;
+
+    ssize_t result = write( device_fd, buffer, buflen );
+
+    // The descriptor is non-blocking, wait a little for the endpoint
+    // if it happens to be busy.
+    if (result < 0 && errno == EAGAIN)
+    {
+        struct pollfd pfd = { .fd = device_fd, .events = POLLOUT };
+        const int ready = poll( &pfd, 1, HIDRAW_WRITE_TIMEOUT_MS );
+
+        if (ready > 0)
+        {
+            result = write( device_fd, buffer, buflen );
+        }
+        else
+        {
+            if (ready == 0) errno = ETIMEDOUT;
+            result = -1;
+        }
+    }
+
+    return (int)result;
+}
+
+
+const hid_backend_t hid_backend_hidraw = {
+    .name = "hidraw",
+    .init = hidraw_init,
+    .close = hidraw_close,
+    .exit = hidraw_exit,
+    .get_fd = hidraw_get_fd,
+    .read = hidraw_read,
+    .write = hidraw_write
+};
@@ -0,0 +1,128 @@
+#include "hotplug.h"
+
+/*
+ * Watches the kernel's uevents on a NETLINK_KOBJECT_UEVENT socket, so a
+ * keyboard that is plugged back in is noticed right away. Only the USB
+ * devices themselves are reported, their interfaces and the HID and
+ * hidraw devices below them are left out.
+ */
+
+static int hotplug_fd = -1;
+static hotplug_handler_t hotplug_handler = NULL;
+static void * hotplug_data = NULL;
+
+
+/*
+ * Returns the value of `key` in a uevent (a `<action>@<devpath>` line
+ * followed by `KEY=value` strings, all NUL terminated), or NULL.
+ */
+static const char * hotplug_get( const char * buffer, int length, const char * key )
+{
+    const size_t key_length = strlen( key );
+
+    for(int offset = strlen( buffer ) + 1; offset < length; offset += strlen( buffer + offset ) + 1)
+    {
+        const char * entry = buffer + offset;
+        if (strncmp( entry, key, key_length ) == 0 && entry[ key_length ] == '=')
+        {
+            return entry + key_length + 1;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void hotplug_on_readable( int fd, unsigned int events, void * data )
+{
+    char buffer[ HOTPLUG_BUFFER_SZ ];
+    struct sockaddr_nl sender;
+    struct iovec iov = { .iov_base = buffer, .iov_len = sizeof buffer - 1 };
+    struct msghdr message = {
+        .msg_name = &sender,
+        .msg_namelen = sizeof sender,
+        .msg_iov = &iov,
+        .msg_iovlen = 1
+    };
+
+    for(;;)
+    {
+        message.msg_namelen = sizeof sender;
+
+        ssize_t length = recvmsg( fd, &message, MSG_DONTWAIT );
+        if (length <= 0) return;
+
+        // Only believe the kernel, not some other process.
+        if (sender.nl_pid != 0) continue;
+
+        buffer[ length ] = 0;
+
+        const char * action = hotplug_get( buffer, length, "ACTION" );
+        const char * subsystem = hotplug_get( buffer, length, "SUBSYSTEM" );
+        const char * devtype = hotplug_get( buffer, length, "DEVTYPE" );
+        const char * product = hotplug_get( buffer, length, "PRODUCT" );
+
+        if (!action || !subsystem || !devtype || !product
+            || strcmp( subsystem, "usb" ) != 0
+            || strcmp( devtype, "usb_device" ) != 0)
+        {
+            continue;
+        }
+
+        // PRODUCT=<vendor>/<product>/<version>, in hex.
+        unsigned int vid, pid;
+        if (sscanf( product, "%x/%x/", &vid, &pid ) != 2) continue;
+
+        if (strcmp( action, "add" ) == 0)
+        {
+            hotplug_handler( HOTPLUG_ADDED, vid, pid, hotplug_data );
+        }
+        else if (strcmp( action, "remove" ) == 0)
+        {
+            hotplug_handler( HOTPLUG_REMOVED, vid, pid, hotplug_data );
+        }
+    }
+}
+
+
+/*
+ * Starts watching for USB devices coming and going, `handler` is called
+ * from the event loop.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int hotplug_open( evloop_t * loop, hotplug_handler_t handler, void * data )
+{
+    struct sockaddr_nl address;
+
+    hotplug_fd = socket( AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT );
+    if (hotplug_fd < 0) return -1;
+
+    // Group 1 has the kernel's own events.
+    memset( &address, 0, sizeof address );
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = 1;
+
+    hotplug_handler = handler;
+    hotplug_data = data;
+
+    if (bind( hotplug_fd, (struct sockaddr *)&address, sizeof address ) < 0
+        || evloop_add( loop, hotplug_fd, EPOLLIN, hotplug_on_readable, NULL ) < 0)
+    {
+        close( hotplug_fd );
+        hotplug_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void hotplug_close( evloop_t * loop )
+{
+    if (hotplug_fd < 0) return;
+
+    evloop_remove( loop, hotplug_fd );
+    close( hotplug_fd );
+    hotplug_fd = -1;
+}
@@ -0,0 +1,29 @@
+#ifndef _HOTPLUG_H_
+#define _HOTPLUG_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "event_loop.h"
+
+// The largest uevent the kernel sends is well below this.
+#define HOTPLUG_BUFFER_SZ       8192
+
+#define HOTPLUG_REMOVED         0
+#define HOTPLUG_ADDED           1
+
+/*
+ * Called when a USB device comes or goes, `action` being HOTPLUG_ADDED
+ * or HOTPLUG_REMOVED.
+ */
+typedef void (*hotplug_handler_t)( int action, int vid, int pid, void * data );
+
+int hotplug_open( evloop_t * loop, hotplug_handler_t handler, void * data );
+void hotplug_close( evloop_t * loop );
+
+#endif /* _HOTPLUG_H_ */
@@ -0,0 +1,42 @@
+#ifndef _KEY_HASH_H_
+#define _KEY_HASH_H_
+
+#include <stdint.h>
+#include <ctype.h>
+
+/*
+ * A slot of the generated name to code table, `name` (without the
+ * "KEY_") is NULL for the empty slots.
+ */
+typedef struct key_entry_t {
+    const char * name;
+    int code;
+} key_entry_t;
+
+/*
+ * The hash behind the generated key name table, shared by the generator
+ * (`tools/gen_key_tables.c`) and `key_parse()` so both agree on where a
+ * name ends up. It is a case-insensitive FNV-1a, as key names are
+ * matched case-insensitively, where `seed` picks one of a family of
+ * hash functions.
+ */
+static inline uint32_t key_hash( const char * name, uint32_t seed )
+{
+    uint32_t hash = 2166136261u ^ (seed * 16777619u);
+
+    for(; *name; name++)
+    {
+        hash ^= (uint32_t)toupper( (unsigned char)*name );
+        hash *= 16777619u;
+    }
+
+    // Mix the last characters into the low bits, which are
+    // the ones the table is indexed with.
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6du;
+    hash ^= hash >> 12;
+
+    return hash;
+}
+
+#endif /* _KEY_HASH_H_ */
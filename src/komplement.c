@@ -1,23 +1,44 @@
 #include "komplement.h"
-//#define KEYS_DEBUG
-//#define DUMP_KEYS_IN
-
-#define PACKET_SZ    8
-#define MAX_BUTTONS 40
-
-#define KEY_PRESS     1
-#define KEY_RELEASE   0
-#define KEY_INITIAL  -1
 
 // The stucture containing the tool configuration. 
 static t_komplement_config cfg;
 
-// Interrupt handling to catch SIGINT and abort gracefully.
-static volatile int read_aborted = 0;
-void handle_interrupt(int dummy) 
-{
-    read_aborted = 1;
-}
+// The event loop that drives everything. SIGINT, SIGTERM and SIGQUIT
+// stop it so we can abort gracefully.
+static evloop_t loop;
+
+// The uinput device the key presses are sent to.
+static int fd_uinput = -1;
+
+// The uinput device for the wheels, only there when a mapping uses them.
+static int fd_rel = -1;
+
+// The keyboards, in the order they were given on the command line.
+static komplement_device_t devices[ HID_MAX_DEVICES ];
+static int device_count = 0;
+
+// Recording and replaying of HID reports.
+static capture_t recording;
+static capture_t replay;
+static int replay_timer = -1;
+
+// The report that is up next when replaying, and what to add to
+// its recorded timestamp to get to the current time.
+static unsigned char replay_report[ HID_REPORT_MAX ];
+static int replay_length = 0;
+static uint64_t replay_timestamp = 0;
+static uint64_t replay_offset = 0;
+static unsigned long replay_total = 0;
+
+// The most reports replayed per wake-up when replaying as fast as
+// possible, so signals are still handled in between.
+#define REPLAY_CHUNK 256
+
+// How long to wait before trying to reopen an unplugged keyboard. The
+// delay doubles with every failed attempt, and starts over when the
+// kernel tells us a keyboard was plugged in.
+#define RECONNECT_MIN_MS    10
+#define RECONNECT_MAX_MS    1000
 
 static void print_usage( char * argv0 )
 {
@@ -29,132 +50,538 @@ static void print_usage( char * argv0 )
         "Options:\n"
         " -o /path/to/uinput   The path to uinput device file (" DEFAULT_UINPUT_PATH ").\n"
         " -m /path/to/mapping  The path to mapping file (required to be useful).\n"
-        " -a                   Do not create ALSA MIDI output port for MMC messages.\n"
+        " --device <productId>:/path/to/mapping\n"
+        "                      Also drive the keyboard with this USB product ID (hex) with\n"
+        "                      its own mapping file. Can be given up to %d times.\n"
+        " -a                   Do not create ALSA MIDI ports for MMC and MIDI messages.\n"
+        " --midi-queue <ms>    Timestamp the MMC and MIDI messages with the time of their\n"
+        "                      button press plus <ms> milliseconds (up to %d), so they keep\n"
+        "                      their timing however long it takes to send them.\n"
         " -n                   Do not animate the buttons when starting/stopping.\n\n"
-        " -q                   Be less verbose.\n"
+        " -q                   Be less verbose.\n\n"
+        " --record <file>      Record all HID reports (of the first keyboard) to <file>.\n"
+        " --replay <file>      Replay the HID reports in <file> instead of reading the keyboard.\n"
+        " --fast               Replay as fast as possible instead of in real time.\n\n"
 
         "Advanced options:\n"
+        " -b <backend>         HID backend, `hidapi` or `hidraw` (default %s).\n"
         " -p <productId>       USB product ID (in case you want to try other hardware).\n"
         " -v <vendorId>        USB vendor ID (in case you want to try other hardware).\n\n"        
         RISK_DISCLAIMER,
-        argv0 );
+        argv0,
+        HID_MAX_DEVICES,
+        ALSA_QUEUE_MAX_OFFSET,
+        hidstuff_backend_name() );
 }
 
 
 /*
- * Helper that sends all the key press or release events to the
- * appropriate destination.
+ * Returns how bright a button is when the software lit it up, which is
+ * brighter than `light_it_up`. With the `blink` or `pulse` option of its
+ * mapping, it blinks or pulses as well (for as long as it is lit).
  */
-static void send_key_wrap( int fd_uinput, mapping_key_t send_key, int press )
+static int lightup_feedback( komplement_device_t * device, const mapping_t * mapping, int index, int layer, int light_it_up )
 {
-    for(int ki = 0; ki < send_key.length; ki++)
+    const int lit = feedback_is_lit( &device->feedback, index, layer );
+    const mapping_key_t * key = mapping_get( mapping, layer, index );
+    int animation = -1;
+
+    if (lit && key->led_style == MAPPING_LED_BLINK) animation = ANIMATION_BLINK;
+    else if (lit && key->led_style == MAPPING_LED_PULSE) animation = ANIMATION_PULSE;
+
+    // This is done for every frame, but the animation is only started
+    // or stopped when that changes.
+    if (animation != animation_playing( device->hid, index ))
     {
-        if (send_key.keys[ki].type == MAPPING_TYPE_KEY)
-        {
-            if (press) 
-            {
-                //printf( "press %d\n", send_key.keys[ki].key );
-                key_press( fd_uinput, send_key.keys[ki].key );
-            } 
-            else 
-            {
-                //printf( "release %d\n", send_key.keys[ki].key );
-                key_release( fd_uinput, send_key.keys[ki].key );
-            }
-        }
-        else if (press)
-        {
-            //printf( "mmc %d\n", send_key.keys[ki].key );
-            alsa_send_mmc( send_key.keys[ki].key, 0 );
-        }
+        if (animation > -1) animation_play( device->hid, animation, index );
+        else animation_stop( device->hid, index );
     }
+
+    return lit ? LED_BRIGHT : light_it_up;
 }
 
 
+
 /*
  * This lights up only the buttons that have an actual action
- * mapped together with SHIFT 
+ * mapped on `layer` (like SHIFT), with the buttons that switched
+ * to it brighter.
  */
-static void lightup_shifted()
+static void lightup_layer( komplement_device_t * device, int layer )
 {
+    // Pairs with the release store of `on_mapping_reloaded()`.
+    const mapping_t * mapping = atomic_load_explicit( &device->mapping, memory_order_acquire );
     int light_it_up;
     for(int i=0; i<TOTAL_HID_BUTTONS; i++)
     {
-        if (i == 0) light_it_up = LED_BRIGHT;
-        else if (mapping_is_mapped(i, 1)) light_it_up = LED_ON;
+        if (i == 0 && layer == MAPPING_LAYER_SHIFT) light_it_up = LED_BRIGHT;
+        else if (mapping_layer_key( mapping_get( mapping, MAPPING_LAYER_NONE, i ) ) == layer) light_it_up = LED_BRIGHT;
+        else if (mapping_is_mapped(mapping, i, layer)) light_it_up = LED_ON;
         else light_it_up = LED_OFF;
             
-        leds_update_led( i, light_it_up );        
+        light_it_up = lightup_feedback( device, mapping, i, layer, light_it_up );
+        leds_update_led( device->hid, i, light_it_up );        
     }
     
-    leds_sync(cfg.vid, cfg.pid);
+    leds_sync( device->hid );
 }
 
 
 
 /*
  * This lights up only those buttons that have a mapping without
- * the SHIFT being pressed
+ * any layer (like SHIFT) being active
  */
-static void lightup_normal()
+static void lightup_normal( komplement_device_t * device )
 {
+    const mapping_t * mapping = atomic_load_explicit( &device->mapping, memory_order_acquire );
     int light_it_up;
     for(int i=0; i<TOTAL_HID_BUTTONS; i++)
     {
-        // shift and octaves always lit
+        // shift and octaves always lit, and brighter when the
+        // software says the button is on.
         light_it_up = (i == 0 
             || i == 19 
             || i == 20 
-            || mapping_is_mapped(i, -1)) ? LED_ON : LED_OFF; 
+            || mapping_is_mapped(mapping, i, MAPPING_LAYER_NONE)) ? LED_ON : LED_OFF; 
+        
+        light_it_up = lightup_feedback( device, mapping, i, MAPPING_LAYER_NONE, light_it_up );
             
-        leds_update_led( i, light_it_up );
+        leds_update_led( device->hid, i, light_it_up );
     }
     
-    leds_sync(cfg.vid, cfg.pid);
+    leds_sync( device->hid );
 }
 
 
 
 /*
- * This lights up the buttons the first time, with a slight delay
- * because I think it's cool.
- * 
- * If cfg.animate is false it will be as good as instant.
+ * Called on the output thread when the layer of a keyboard changes,
+ * `device` being its index in `devices`.
+ */
+static void lightup_for_layer( int device, int layer )
+{
+    if (device < 0 || device >= device_count || devices[ device ].hid < 0) return;
+
+    if (layer != MAPPING_LAYER_NONE) lightup_layer( &devices[ device ], layer );
+    else lightup_normal( &devices[ device ] );
+}
+
+
+
+/*
+ * Called by the event loop when the software sends something to the
+ * ALSA input port, which lights up the buttons it is about on every
+ * keyboard that is plugged in.
+ */
+static void on_midi_input( mapped_key_t message, void * data )
+{
+    const uint64_t timestamp = evloop_now();
+
+    for(int i=0; i<device_count; i++)
+    {
+        // Only the event loop stores the mapping, so it can't be torn here.
+        const mapping_t * mapping = atomic_load_explicit( &devices[i].mapping, memory_order_relaxed );
+
+        if (feedback_update( &devices[i].feedback, mapping, message )
+            && devices[i].fd > -1)
+        {
+            // The LED write is done on the output thread.
+            output_push( OUTPUT_LEDS, i, devices[i].dispatch.layer, timestamp );
+        }
+    }
+
+    output_flush();
+}
+
+
+
+/*
+ * This lights up the buttons the first time. With cfg.animate they stay
+ * dark for now, until ANIMATION_START lights them up one by one.
  * 
  * Returns -1 if the LEDs could not be synced, 0 otherwise.
  */
-static int lightup_initial()
+static int lightup_initial( komplement_device_t * device )
 {
+    const mapping_t * mapping = atomic_load_explicit( &device->mapping, memory_order_relaxed );
+
     for(int i=0; i<TOTAL_HID_BUTTONS; i++)
     {
         // shift and octaves always lit
-        int light_it_up = (i == 0 || i == 19 || i == 20 || mapping_is_mapped(i, -1)) ? 1 : 0;
-        leds_update_led( i, light_it_up ? LED_ON : LED_OFF );
+        int light_it_up = (i == 0 || i == 19 || i == 20 || mapping_is_mapped(mapping, i, MAPPING_LAYER_NONE)) ? 1 : 0;
+        leds_update_led( device->hid, i, light_it_up ? LED_ON : LED_OFF );
+        
+        if (cfg.animate) leds_overlay( device->hid, i, LED_OFF );
+    }
+    
+    return leds_sync( device->hid ) < 0 ? -1 : 0;
+}
+
+
+static void on_hid_readable( int fd, unsigned int events, void * data );
+
+
+/*
+ * This resets the HID device back to "MIDI Mode".
+ */
+static void device_midi_mode( komplement_device_t * device )
+{
+    // These 3 bytes put the device into a certain mode where all the normal
+    // operation ceases and it interfaces with the operating system, let's
+    // call that "Interactive Mode".
+    // unsigned char hid_packet_interactive[] = { 0xa0, 0x03, 0x04 };
+
+    unsigned char hid_packet_midi_mode[] = { 0xa0, 0x07, 0x00 };
+    hidstuff_send_raw( device->hid, hid_packet_midi_mode, 3, NULL, 0 );
+}
+
+
+/*
+ * Hands the reports of a keyboard to the event loop.
+ * 
+ * Returns -1 on error, 0 if all is well.
+ */
+static int device_watch( komplement_device_t * device )
+{
+    int fd_hid = hidstuff_get_fd( device->hid );
+    if (fd_hid < 0 || evloop_add( &loop, fd_hid, EPOLLIN | EPOLLRDHUP, on_hid_readable, device ) < 0)
+    {
+        return -1;
+    }
+
+    device->fd = fd_hid;
+    device->read_errors = 0;
+    return 0;
+}
+
+
+/*
+ * Called when a keyboard stopped responding, most likely because it was
+ * unplugged. Whatever was held down is released and the keyboard is
+ * closed, while uinput and ALSA stay as they are. It is reopened as soon
+ * as it is back.
+ */
+static void device_lost( komplement_device_t * device )
+{
+    printf( "Lost the keyboard %04x:%04x, waiting for it to come back.\n", cfg.vid, device->pid );
+
+    if (device->fd > -1) evloop_remove( &loop, device->fd );
+    device->fd = -1;
+
+    // Closing it also closes the descriptor.
+    hidstuff_close( device->hid );
+
+    dispatch_release( &device->dispatch, evloop_now() );
+
+    device->reconnect_delay = RECONNECT_MIN_MS;
+    evloop_timer_set( device->reconnect_timer, device->reconnect_delay, 0 );
+}
+
+
+/*
+ * Tries to reopen a keyboard that was lost, and lights it up as it
+ * was. If it isn't there (yet), this tries again a bit later.
+ */
+static void on_reconnect_timer( int fd, unsigned int events, void * data )
+{
+    komplement_device_t * device = data;
+
+    if (device->fd > -1) return;
+
+    if (hidstuff_reopen( device->hid, cfg.vid, device->pid ) == 0)
+    {
+        device_midi_mode( device );
+
+        if (device_watch( device ) == 0)
+        {
+            if (!cfg.quiet) printf( "The keyboard %04x:%04x is back.\n", cfg.vid, device->pid );
+
+            // The LED buffer was kept, but the keyboard has forgotten
+            // it. The output thread lights it up again, for the layer
+            // that is still latched (the held ones were released when
+            // it was lost).
+            leds_invalidate( device->hid );
+            output_push( OUTPUT_LEDS, device - devices, device->dispatch.layer, evloop_now() );
+            output_flush();
+            return;
+        }
+
+        hidstuff_close( device->hid );
+    }
+
+    device->reconnect_delay *= 2;
+    if (device->reconnect_delay > RECONNECT_MAX_MS) device->reconnect_delay = RECONNECT_MAX_MS;
+
+    evloop_timer_set( fd, device->reconnect_delay, 0 );
+}
+
+
+/*
+ * Called by the event loop when a USB device comes or goes. When one of
+ * the keyboards we lost is plugged in, it is reopened right away.
+ */
+static void on_hotplug( int action, int vid, int pid, void * data )
+{
+    if (action != HOTPLUG_ADDED || vid != cfg.vid) return;
+
+    for(int i=0; i<device_count; i++)
+    {
+        if (devices[i].fd < 0 && devices[i].pid == pid)
+        {
+            devices[i].reconnect_delay = RECONNECT_MIN_MS;
+            evloop_timer_set( devices[i].reconnect_timer, 1, 0 );
+        }
+    }
+}
+
+
+/*
+ * Called by the event loop when the mapping file of keyboard `index`
+ * changed and was read again. The new actions are used from the next
+ * report on, and the output thread frees the old ones (and the old
+ * mapping) once it has sent the releases of the buttons that were held.
+ *
+ * Returns -1 while too many old ones are still waiting for the output
+ * thread to free them (it is read again later then), 0 otherwise.
+ */
+static int on_mapping_reloaded( int index, mapping_t * mapping, action_table_t * actions, void * data )
+{
+    komplement_device_t * device = &devices[ index ];
+    mapping_t * old_mapping = atomic_load_explicit( &device->mapping, memory_order_relaxed );
+    action_table_t * old_actions = device->actions;
+    const uint64_t timestamp = evloop_now();
+
+    if (!output_can_free( 2 )) return -1;
+
+    dispatch_reload( &device->dispatch, actions, timestamp );
+    device->actions = actions;
+
+    // The output thread draws the LEDs from it, with an acquire load
+    // that sees the mapping complete once it sees the new pointer.
+    atomic_store_explicit( &device->mapping, mapping, memory_order_release );
+
+    output_push_free( old_actions, timestamp );
+    output_push_free( old_mapping, timestamp );
+
+    // The LED write is done on the output thread.
+    if (device->fd > -1) output_push( OUTPUT_LEDS, index, device->dispatch.layer, timestamp );
+    output_flush();
+
+    if (!cfg.quiet) printf( "The mapping file `%s` was read again.\n", device->mapping_path );
+
+    // The wheels' uinput device is only created when starting.
+    if (fd_rel < 0 && mapping_uses_type( mapping, MAPPING_TYPE_REL ))
+    {
+        printf( "The wheels of `%s` only move after a restart.\n", device->mapping_path );
+    }
+
+    return 0;
+}
+
+
+/*
+ * Called by the event loop when a keyboard (`data`) has a report for us.
+ */
+static void on_hid_readable( int fd, unsigned int events, void * data )
+{
+    komplement_device_t * device = data;
+    unsigned char keypress_buffer[ HID_REPORT_MAX ];
+
+    // Drain everything that is queued up, so a burst of reports
+    // costs a single wake-up.
+    for(;;)
+    {
+        int keypress_buffer_read = hidstuff_read_raw( device->hid, keypress_buffer, sizeof keypress_buffer, 0 );
+        if (keypress_buffer_read == -1) 
+        {
+            printf( "Error reading HID device %04x:%04x.\n", cfg.vid, device->pid );
+            
+            // A hang-up means the reader already gave up.
+            if (events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) device->read_errors = HID_MAX_READ_ERRORS;
+            
+            device->read_errors++;
+            if (device->read_errors > HID_MAX_READ_ERRORS) 
+            {
+                device_lost( device );
+            }
+            
+            return;
+        }
+        else if (keypress_buffer_read == 0) 
+        {
+            return;
+        }
         
-        if (leds_sync(cfg.vid, cfg.pid) < 0)
+        // If we get here, we clear out read_errors.
+        device->read_errors = 0;
+        
+        const uint64_t timestamp = evloop_now();
+        if (recording.file && device == &devices[0]
+            && capture_write( &recording, timestamp, keypress_buffer, keypress_buffer_read ) < 0)
+        {
+            perror( "record" );
+            capture_close( &recording );
+        }
+
+        // The report holds the 4D dial position at index 28, so anything
+        // shorter than that is not a button report.
+        if (keypress_buffer_read < DISPATCH_REPORT_MIN_SZ)
         {
-            return -1;
+            continue;
         }
 
-        if (cfg.animate)
-            usleep( 5000 );
+        dispatch_report( &device->dispatch, keypress_buffer, keypress_buffer_read, timestamp );
+    }
+}
+
+
+/*
+ * Reads the next report from the recording that is replayed.
+ * 
+ * Returns 0 when there is nothing left.
+ */
+static int replay_next()
+{
+    replay_length = capture_read( &replay, &replay_timestamp, replay_report, sizeof replay_report );
+    if (replay_length < 0)
+    {
+        printf( "The recording `%s` is damaged, replay stopped.\n", cfg.replay_path );
     }
     
-    return 0;
+    return replay_length > 0;
 }
 
 
-unsigned char reverse_bits_in_byte( unsigned char byte, char bits )
+/*
+ * Called by the event loop when the next replayed report is due. This 
+ * goes through the same path as the reports from the keyboard.
+ */
+static void on_replay_timer( int fd, unsigned int events, void * data )
+{
+    const uint64_t now = evloop_now();
+    int handled = 0;
+    
+    while (replay_length > 0)
+    {
+        if (cfg.replay_fast)
+        {
+            if (handled == REPLAY_CHUNK) break;
+            
+            // Don't overrun the output ring.
+            output_wait_idle();
+        }
+        else if (replay_timestamp + replay_offset > now)
+        {
+            break;
+        }
+        
+        if (replay_length >= DISPATCH_REPORT_MIN_SZ)
+        {
+            dispatch_report( &devices[0].dispatch, replay_report, replay_length, replay_timestamp + replay_offset );
+        }
+        
+        replay_total++;
+        handled++;
+        replay_next();
+    }
+    
+    if (replay_length <= 0)
+    {
+        // That was all, so we're done.
+        evloop_stop( &loop );
+        return;
+    }
+    
+    evloop_timer_set_at( fd, cfg.replay_fast ? 1 : replay_timestamp + replay_offset );
+}
+
+
+/*
+ * Opens the recording and schedules the first report.
+ * 
+ * Returns -1 on error, 0 if all is well.
+ */
+static int replay_start()
 {
-    unsigned char result = 0;
-    for(int i=0; i<bits; i++)
+    if (capture_open( &replay, cfg.replay_path, 0 ) < 0)
     {
-        if ((byte & (1 << i)))
-            result |= 1 << ((bits - 1) - i);   
+        printf( "The recording `%s` could not be read.\n", cfg.replay_path );
+        return -1;
     }
-    return result;
+    
+    replay_timer = evloop_timer_new( &loop, on_replay_timer, NULL );
+    if (replay_timer < 0) return -1;
+    
+    // The first report is replayed right away, the others keep the
+    // recorded time between them.
+    if (replay_next())
+    {
+        replay_offset = evloop_now() - replay_timestamp;
+    }
+    
+    evloop_timer_set_at( replay_timer, 1 );
+    return 0;
+}
+
+
+/*
+ * Adds a keyboard from a `<productId>:<mapping>` option.
+ * 
+ * Returns -1 if the option is malformed or there are too many
+ * keyboards, 0 if all is well.
+ */
+static int device_add( int pid, const char * mapping_path )
+{
+    if (device_count == HID_MAX_DEVICES) return -1;
+    
+    komplement_device_t * device = &devices[ device_count++ ];
+    
+    memset( device, 0, sizeof(komplement_device_t) );
+    device->pid = pid;
+    device->mapping_path = strdup( mapping_path );
+    device->hid = -1;
+    device->fd = -1;
+    device->reconnect_timer = -1;
+    
+    return 0;
+}
+
+
+static int device_add_option( const char * option )
+{
+    char * colon = NULL;
+    const int pid = strtol( option, &colon, 16 );
+    
+    if (colon == option || *colon != ':' || colon[1] == 0) return -1;
+    
+    return device_add( pid, colon + 1 );
+}
+
+
+/*
+ * Opens the HID device of a keyboard, puts it in MIDI mode and lights
+ * up its mapped buttons.
+ * 
+ * Returns -1 on error, 0 if all is well.
+ */
+static int device_open( komplement_device_t * device )
+{
+    // Initialise HIDAPI:
+    device->hid = hidstuff_init( cfg.vid, device->pid );
+    if (device->hid < 0) return -1;
+
+    device_midi_mode( device );
+
+    // Button led state initialise.
+    leds_init( device->hid );
+
+    // Initial LED state, the animation is played by the output thread
+    // once it runs.
+    return lightup_initial( device );
 }
 
+
 int main(int argc, char* argv[])
 {
     // 
@@ -172,11 +599,25 @@ int main(int argc, char* argv[])
     cfg.animate = true;
     cfg.quiet = false;
     cfg.midi_controller = true;
+    cfg.midi_queue_offset = -1;
     
     
+    static const struct option long_options[] = {
+        { "record", required_argument, NULL, 'R' },
+        { "replay", required_argument, NULL, 'P' },
+        { "fast",   no_argument,       NULL, 'F' },
+        { "device", required_argument, NULL, 'D' },
+        { "midi-queue", required_argument, NULL, 'Q' },
+        { NULL, 0, NULL, 0 }
+    };
+    
+    // The keyboards given with --device, added after the one of -m.
+    char * device_options[ HID_MAX_DEVICES ];
+    int device_option_count = 0;
+    
     int opt;
     int total_options_parsed = 0;
-    while ((opt = getopt( argc, argv, "v:p:m:o:qnha" )) != -1)
+    while ((opt = getopt_long( argc, argv, "v:p:m:o:b:qnha", long_options, NULL )) != -1)
     {
         total_options_parsed++;
         switch(opt)
@@ -194,6 +635,14 @@ int main(int argc, char* argv[])
                 // printf( "ProductID: %4x\n", cfg.pid );
                 break;
                 
+            case 'b':
+                if (hidstuff_set_backend( optarg ) < 0)
+                {
+                    printf( "ERROR: Unknown HID backend `%s`.\n", optarg );
+                    return 1;
+                }
+                break;
+                
             case 'm': 
                 cfg.mapping_path = strdup(optarg);
                 break;
@@ -213,6 +662,36 @@ int main(int argc, char* argv[])
             case 'a': 
                 cfg.midi_controller = false;
                 break;
+                
+            case 'R':
+                cfg.record_path = strdup(optarg);
+                break;
+                
+            case 'P':
+                cfg.replay_path = strdup(optarg);
+                break;
+                
+            case 'F':
+                cfg.replay_fast = true;
+                break;
+                
+            case 'Q':
+                cfg.midi_queue_offset = atoi(optarg);
+                if (cfg.midi_queue_offset < 0 || cfg.midi_queue_offset > ALSA_QUEUE_MAX_OFFSET)
+                {
+                    printf( "ERROR: The --midi-queue offset is 0 to %d milliseconds.\n", ALSA_QUEUE_MAX_OFFSET );
+                    return 1;
+                }
+                break;
+                
+            case 'D':
+                if (device_option_count == HID_MAX_DEVICES)
+                {
+                    printf( "ERROR: At most %d keyboards are supported.\n", HID_MAX_DEVICES );
+                    return 1;
+                }
+                device_options[ device_option_count++ ] = optarg;
+                break;
         }
     }
     
@@ -229,28 +708,33 @@ int main(int argc, char* argv[])
     }
     
 
-    // Install signal handler now...
-    signal( SIGINT, handle_interrupt );
-    signal( SIGTERM, handle_interrupt );
-    signal( SIGQUIT, handle_interrupt );
+    // Set up the event loop and have it handle the signals now, before 
+    // any threads are started...
+    if (evloop_init( &loop ) < 0 || evloop_handle_signals( &loop ) < 0
+        || repeat_init( &loop ) < 0)
+    {
+        perror( "event loop" );
+        return 1;
+    }
     
 
-    // Set up the button mappings...
-    mapping_init();
-
-    
-    // Read the configuration, and then only light up
-    // those buttons that have an actual mapping.;
+    // The keyboard of -m (and -p) comes first, then those of --device.
     if (cfg.mapping_path)
     {
-        if (config_read( cfg.mapping_path, cfg.quiet ? 0 : 1 ) < 0)
+        device_add( cfg.pid, cfg.mapping_path );
+    }
+    
+    for(int i=0; i<device_option_count; i++)
+    {
+        if (device_add_option( device_options[i] ) < 0)
         {
-            printf( "The mapping file could not be read.\n" );
-            return_code = 2;
+            printf( "ERROR: `%s` is not a valid --device, use <productId>:<mapping>.\n", device_options[i] );
+            return_code = 1;
             goto clean_up_and_exit;
         }
     }
-    else
+    
+    if (device_count == 0)
     {
         print_usage( argv[0] );
         printf( "ERROR: The -m <mapping> option is required.\n" );
@@ -258,45 +742,60 @@ int main(int argc, char* argv[])
         
         goto clean_up_and_exit;
     }
-   
-    // Initialise HIDAPI:
-    hidstuff_init( cfg.vid, cfg.pid );
     
-    // These 3 bytes put the device into a certain mode where all the normal
-    // operation ceases and it interfaces with the operating system, let's
-    // call that "Interactive Mode".
-    // unsigned char hid_packet_interactive[] = { 0xa0, 0x03, 0x04 };
-    
-    // This resets the HID device back to "MIDI Mode":
-    unsigned char hid_packet_midi_mode[] = { 0xa0, 0x07, 0x00 };
-    hidstuff_send_raw( hid_packet_midi_mode, 3, NULL, 0 );
     
-    // Button led state initialise.
-    leds_init();
-    
-    // Animates the button state, eventually this 
-    // should hilite only the mapped buttons and
-    // keep the rest dark.
-    if (cfg.animate)
+    // Read the configuration of every keyboard, and then only light
+    // up those buttons that have an actual mapping.
+    for(int i=0; i<device_count; i++)
     {
-        leds_animate_on(cfg.vid, cfg.pid);
-    }
+        komplement_device_t * device = &devices[i];
+
+        // Set up the button mappings...
+        device->mapping = malloc( sizeof(mapping_t) );
+        if (!device->mapping)
+        {
+            perror( "mapping" );
+            return_code = 2;
+            goto clean_up_and_exit;
+        }
+        
+        mapping_init( device->mapping );
         
+        if (config_read( device->mapping, device->mapping_path, cfg.quiet ? 0 : 1 ) < 0)
+        {
+            printf( "The mapping file `%s` could not be read.\n", device->mapping_path );
+            return_code = 2;
+            goto clean_up_and_exit;
+        }
+        
+        device->actions = action_compile( device->mapping );
+        if (!device->actions)
+        {
+            printf( "The mapping file `%s` could not be compiled.\n", device->mapping_path );
+            return_code = 2;
+            goto clean_up_and_exit;
+        }
+        
+        dispatch_init( &device->dispatch, i, device->actions );
+        feedback_init( &device->feedback );
+    }
    
-    // Initial LED state.
-    if (lightup_initial() < 0)
+    // When replaying a recording there is no keyboard to talk to.
+    for(int i=0; i<device_count && !cfg.replay_path; i++)
     {
-        printf( 
-            "Opening the HID device %04x:%04x failed.\n"
-            "Did you pass the right vendorId and productId? Does the current user have permissions?\n",
-            cfg.vid, 
-            cfg.pid
-        );
+        if (device_open( &devices[i] ) < 0)
+        {
+            printf( 
+                "Opening the HID device %04x:%04x failed.\n"
+                "Did you pass the right vendorId and productId? Does the current user have permissions?\n",
+                cfg.vid, 
+                devices[i].pid
+            );
             
-        goto clean_up_and_exit;
+            goto clean_up_and_exit;
+        }
     }
     
-
     
     // Set up MIDI output.
     if (cfg.midi_controller)
@@ -312,16 +811,18 @@ int main(int argc, char* argv[])
         {
             printf( "ALSA output port created.\n"  );
         }
+        
+        if (cfg.midi_queue_offset > -1 && alsa_start_queue( cfg.midi_queue_offset ) < 0)
+        {
+            printf( "Error starting the ALSA queue.\n" );
+            return_code = 10;
+            goto clean_up_and_exit;
+        }
     }
     
     
-    // The `button_state` is to keep track of changes 
-    // in button press state. 0: released, 1: pressed, -1: initial
-    char button_state[ MAX_BUTTONS ]; // button 0..39
-    memset( button_state, 0, MAX_BUTTONS );
-    
     // Set up uinput device.
-    int fd_uinput = uinput_open( cfg.uinput_path );
+    fd_uinput = uinput_open( cfg.uinput_path );
     if (fd_uinput < 0)
     {
         // close(fd);
@@ -338,195 +839,161 @@ int main(int argc, char* argv[])
         goto clean_up_and_exit;
     }
 
-    int read_errors = 0;
-    
-    char position_4d_dial = -1; // to determine the way the dial goes
-    bool shift_was_pressed = false;
-    
-    // read packets until interrupted
-    while (read_aborted == 0)
+    for(int i=0; i<device_count; i++)
     {
-        size_t keypress_buffer_size = 30; 
-        unsigned char keypress_buffer[ 30 ];      
-//        printf( "trying to read...\n" );
-        
-        //int keypress_buffer_read = hidstuff_read_raw( &keypress_buffer, keypress_buffer_size, 1 );
-        int keypress_buffer_read = hidstuff_read_raw_timeout( &keypress_buffer, keypress_buffer_size, 2000 );
-        if (keypress_buffer_read == -1) 
+        if (fd_rel < 0 && mapping_uses_type( devices[i].mapping, MAPPING_TYPE_REL ))
         {
-            printf( "Error reading HID device.\n" );
-            
-            read_errors++;
-            if (read_errors > 10) 
+            fd_rel = uinput_open_rel( cfg.uinput_path );
+            if (fd_rel < 0)
             {
-                printf( "Too many read errors, aborting." );
+                perror( "uinput open" );
+                return_code = -2;
                 goto clean_up_and_exit;
             }
-            
-            continue;
-        }
-        else if (keypress_buffer_read == 0) 
-        {
-            continue;
         }
-        
-        // If we get here, we clear out read_errors.
-        read_errors = 0;
-        
-#ifdef KEYS_DEBUG
-        printf( "read %d\n", keypress_buffer_read );
-#endif
-        
-#ifdef DUMP_KEYS_IN
-        // 00000001
-        // 00000000     // these bytes identify the pressed/released key
-        // 00000000     // but the bit order is flipped.
-        // 00000000
-        // 00000000
-        // dump the buffer as binary
-        for(int b=0; b<keypress_buffer_read; b++)
+    }
+
+    // The HID writes of the LEDs go through their own thread, so neither
+    // reading the keyboard nor the output thread waits for them.
+    if (leds_start_writer() < 0)
+    {
+        printf( "The LED writer could not be started, the LEDs are written right away.\n" );
+    }
+    
+    // From here on, uinput, ALSA and the LEDs are only touched by the
+    // output thread.
+    if (output_start( fd_uinput, fd_rel, lightup_for_layer ) < 0)
+    {
+        printf( "The output thread could not be started.\n" );
+        return_code = 3;
+        goto clean_up_and_exit;
+    }
+    
+    // The buttons light up while the keyboard can already be used.
+    for(int i=0; i<device_count && cfg.animate; i++)
+    {
+        if (devices[i].hid > -1) output_push( OUTPUT_ANIMATE, devices[i].hid, ANIMATION_START, evloop_now() );
+    }
+    output_flush();
+    
+    // The software can light up the buttons through the input port.
+    if (cfg.midi_controller && !cfg.replay_path
+        && alsa_watch( &loop, on_midi_input, NULL ) < 0)
+    {
+        printf( "The ALSA input port could not be added to the event loop.\n" );
+    }
+    
+    // Everything from here on is driven by the event loop.
+    if (cfg.replay_path)
+    {
+        if (replay_start() < 0)
         {
-            printf( "%08b ", keypress_buffer[b] );
-            if ((b+1) % 8 == 0) printf( "\n" );
+            return_code = 4;
+            goto clean_up_and_exit;
         }
-        printf( "\n" );
-#endif 
-        
-        // Determine the pressed keys. Multiple keys can be pressed
-        // at the same time.
-        const long key_value = ((long)keypress_buffer[1])
-                | ((long)keypress_buffer[2]) << 8
-                | ((long)keypress_buffer[3]) << 16
-                | ((long)keypress_buffer[4]) << 24;
-            
-#ifdef KEYS_DEBUG
-        printf( "key value: %032b %ld\n", key_value, key_value  );
-#endif
-            
-        const bool shift_is_pressed = key_value & 1;
-        if (shift_is_pressed != shift_was_pressed) 
+    }
+    else
+    {
+        for(int i=0; i<device_count; i++)
         {
-#ifdef KEYS_DEBUG
-            printf( "Shift state changed: %s\n", shift_is_pressed ? "PRESSED":"RELEASED" );
-#endif
-            
-            if (shift_is_pressed) lightup_shifted();
-            else lightup_normal();
-            
-            shift_was_pressed = shift_is_pressed;
-
+            devices[i].reconnect_timer = evloop_timer_new( &loop, on_reconnect_timer, &devices[i] );
             
-            // Note that, when SHIFT is released before any other button is released, 
-            // the code handling key releases will send the incorrect release because
-            // the lookup of the mapping is affected by the (changed) SHIFT state.
-            //
-            // So if SHIFT is released, also any other button state should be reset,
-            // and any held down buttons assumed to be released, too.
-            if (!shift_is_pressed)
+            if (devices[i].reconnect_timer < 0 || device_watch( &devices[i] ) < 0)
             {
-                // Find the buttons that were pressed (apart from SHIFT).
-                for(int si=1; si < MAX_BUTTONS; si++)
-                {
-                    if (button_state[si])
-                    {
-                        send_key_wrap( fd_uinput, 
-                                       mapping_get_shifted( si ), 
-                                       0 );
-                    }
-
-                } // for...
-                
-                // And clear it all out.
-                memset( button_state, 0, MAX_BUTTONS );
+                printf( "The HID device could not be added to the event loop.\n" );
+                return_code = 3;
+                goto clean_up_and_exit;
             }
         }
         
-        
-        
-        unsigned char new_dial_position = keypress_buffer[ 28 ];
-        int dial_change = 0;
-        
-        if (position_4d_dial == -1)
+        // Without it, unplugged keyboards are still found again, only
+        // not as quickly.
+        if (hotplug_open( &loop, on_hotplug, NULL ) < 0)
         {
-            position_4d_dial = new_dial_position;
-        } 
-        else
-        {        
-            if (new_dial_position == 0xf && position_4d_dial == 0) {
-                // It decremented and wrapped.
-                dial_change = -1;
-            } else if (new_dial_position == 0x0 && position_4d_dial == 0xf) {
-                // It incremented and wrapped 
-                dial_change = +1;
-            } else {
-                dial_change = new_dial_position - position_4d_dial;
-            }
-        
-            if (dial_change != 0)
-            {   
-                // It actually changed, so we send a keydown / key up event.
-                const mapping_key_t send_key = mapping_get( 
-                    dial_change > 0 ? DIAL_CW_INDEX : DIAL_CCW_INDEX 
-                );
-
-                // We want to send this as a single keypress/release
-                // event, so first this.
-                send_key_wrap( fd_uinput, send_key, 1 );
-
-#ifdef KEYS_DEBUG
-                if (dial_change > 0) {
-                    printf( "4D dial INC\n" );
-                } else if (dial_change < 0) {
-                    printf( "4D dial DEC\n" );
-                }
-#endif /* KEYS_DEBUG */
-
-                // And release it...
-                send_key_wrap( fd_uinput, send_key, 0 );
-                position_4d_dial = new_dial_position;
-            }
+            perror( "hotplug" );
         }
         
-        // So if any button is pressed, then the relevant bit would be set.
-        // The shift is ignored, so we start at '1'.
-        for(int button_number = 1; button_number < TOTAL_HID_BUTTONS; button_number++)
+        if (cfg.record_path && capture_open( &recording, cfg.record_path, 1 ) < 0)
         {
-            long test_value = 1 << button_number;   
-            int  new_button_state = (key_value & test_value) ? 1 : 0; // pressed or released
-            
-            if (new_button_state != button_state[ button_number ])
-            {
-                // This key is pressed, so if there is any mapping, let's
-                // do something with it.
-                const mapping_key_t send_key = shift_is_pressed
-                    ? mapping_get_shifted( button_number )
-                    : mapping_get( button_number );
-
-                send_key_wrap( fd_uinput, send_key, new_button_state );
-                button_state[ button_number ] = new_button_state;
-            }
+            printf( "The recording `%s` could not be created.\n", cfg.record_path );
+            return_code = 4;
+            goto clean_up_and_exit;
         }
-        
-    } // while...
+    }
+
+    // Without it, the mapping files are only read when starting.
+    if (reload_open( &loop, on_mapping_reloaded, NULL ) < 0)
+    {
+        perror( "reload" );
+    }
+    
+    for(int i=0; i<device_count; i++)
+    {
+        if (reload_watch( i, devices[i].mapping_path ) < 0)
+        {
+            printf( "The mapping file `%s` is not watched for changes.\n", devices[i].mapping_path );
+        }
+    }
+
+    evloop_run( &loop );
+    
+    if (cfg.replay_path && !cfg.quiet)
+    {
+        printf( "Replayed %lu reports.\n", replay_total );
+    }
     
 clean_up_and_exit:
 
+    // The buttons go dark one by one before the output thread stops.
+    for(int i=0; i<device_count && cfg.animate; i++)
+    {
+        if (devices[i].fd > -1) output_push( OUTPUT_ANIMATE, devices[i].hid, ANIMATION_STOP, evloop_now() );
+    }
+
+    // Sends whatever is still queued before the outputs go away.
+    output_stop();
+    leds_stop_writer();
+    
+    if (!cfg.quiet)
+    {
+        output_print_stats();
+        leds_print_stats();
+    }
+
     // clean-up stuff
+    alsa_unwatch( &loop );
     alsa_close_client();
         
+    capture_close( &recording );
+    capture_close( &replay );
+    
     if (cfg.uinput_path) free(cfg.uinput_path);
     if (cfg.mapping_path) free(cfg.mapping_path);
     
     //if (fd>-1) close(fd);
     if (fd_uinput>-1) uinput_close(fd_uinput);
+    if (fd_rel>-1) uinput_close(fd_rel);
     
-    if (cfg.animate) {
-        leds_animate_off(cfg.vid, cfg.pid);
-    } else {
-        leds_off(cfg.vid, cfg.pid);
+    for(int i=0; i<device_count; i++)
+    {
+        // When replaying there is no keyboard, so no LEDs either.
+        if (devices[i].hid > -1) leds_off( devices[i].hid );
+        
+        if (devices[i].reconnect_timer > -1) evloop_timer_free( &loop, devices[i].reconnect_timer );
+        free( devices[i].mapping_path );
+        free( devices[i].mapping );
+        action_free( devices[i].actions );
     }
     
+    reload_close( &loop );
+    hotplug_close( &loop );
+    repeat_exit( &loop );
+    
+    if (cfg.record_path) free(cfg.record_path);
+    if (cfg.replay_path) free(cfg.replay_path);
+    
     hidstuff_exit();
+    evloop_exit( &loop );
     
     return return_code;
 }
@@ -7,6 +7,8 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <getopt.h>
 #include <linux/hiddev.h>
 
 #include "button_names.h"
@@ -16,10 +18,52 @@
 #include "config.h"
 #include "version.h"
 #include "alsa.h"
+#include "hid.h"
+#include "event_loop.h"
+#include "output.h"
+#include "dispatch.h"
+#include "capture.h"
+#include "hotplug.h"
+#include "feedback.h"
+#include "action.h"
+#include "reload.h"
 
 #define DEFAULT_HIDDEV_PATH     "/dev/usb/hiddev0"
 #define DEFAULT_UINPUT_PATH     "/dev/uinput"
 
+/*
+ * A keyboard with everything that belongs to it. One `komplement`
+ * can drive up to HID_MAX_DEVICES of them, sharing a single uinput
+ * device and ALSA port.
+ */
+typedef struct komplement_device_t {
+    // USB ProductId, the VendorId is the same for all of them.
+    int pid;
+    
+    // Path to mapping configuration, what it maps and what the buttons
+    // do (compiled from the mapping). Both are replaced when the file
+    // changes, and the mapping is also read by the output thread.
+    char * mapping_path;
+    mapping_t * _Atomic mapping;
+    action_table_t * actions;
+    
+    // The HID device number, -1 if it is not open.
+    int hid;
+    int read_errors;
+    
+    // The descriptor in the event loop, -1 while the keyboard is
+    // unplugged. It is then reopened by `reconnect_timer`, trying
+    // again after `reconnect_delay` milliseconds.
+    int fd;
+    int reconnect_timer;
+    long reconnect_delay;
+    
+    dispatch_t dispatch;
+
+    // The buttons the software lit up through the ALSA input port.
+    feedback_t feedback;
+} komplement_device_t;
+
 typedef struct t_komplement_config {
     
     // Output stuff
@@ -30,6 +74,10 @@ typedef struct t_komplement_config {
     // can be used as input by other software
     bool midi_controller;
     
+    // Schedule the ALSA events on a queue, this many milliseconds
+    // after their report came in (-1 sends them right away).
+    int midi_queue_offset;
+    
     // Path to mapping configuration.
     char * mapping_path;
     
@@ -40,6 +88,14 @@ typedef struct t_komplement_config {
     int vid;
     int pid;
     
+    // Record the HID reports (of the first keyboard) to this file.
+    char * record_path;
+    
+    // Replay the HID reports from this file instead of reading
+    // them from the keyboard, in real time or as fast as possible.
+    char * replay_path;
+    bool replay_fast;
+    
 } t_komplement_config;
 
 #endif /* _KOMPLEMENT_H_ */
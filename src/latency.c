@@ -0,0 +1,167 @@
+#include "latency.h"
+#include <time.h>
+
+/*
+ * A histogram per sink with log-linear buckets: values below
+ * LATENCY_SUB_BUCKETS nanoseconds get a bucket each, above that every
+ * power of two is split in LATENCY_SUB_BUCKETS equal parts. Only the
+ * output thread records, the totals are read once it has stopped.
+ */
+typedef struct latency_histogram_t {
+    unsigned long count;
+    uint64_t max;
+    uint64_t sum;
+    unsigned long buckets[ LATENCY_BUCKETS ];
+} latency_histogram_t;
+
+static latency_histogram_t histograms[ LATENCY_SINKS ];
+
+// The report time of the event that is being sent out.
+static uint64_t started = 0;
+
+
+static int latency_bucket( uint64_t value )
+{
+    if (value < LATENCY_SUB_BUCKETS) return value;
+
+    const int exponent = 63 - __builtin_clzll( value );
+    const int sub = (value >> (exponent - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+
+    return (exponent - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+
+/*
+ * Returns the highest value that ends up in `bucket`.
+ */
+static uint64_t latency_bucket_max( int bucket )
+{
+    if (bucket < LATENCY_SUB_BUCKETS) return bucket;
+
+    const int exponent = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1;
+    const uint64_t sub = bucket % LATENCY_SUB_BUCKETS;
+
+    return ((LATENCY_SUB_BUCKETS + sub + 1) << (exponent - LATENCY_SUB_BITS)) - 1;
+}
+
+
+static uint64_t latency_now()
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+void latency_reset()
+{
+    memset( histograms, 0, sizeof histograms );
+    started = 0;
+}
+
+
+/*
+ * Remembers the time the report of the event that is about to be sent
+ * came in. Called on the output thread.
+ */
+void latency_begin( uint64_t timestamp )
+{
+    started = timestamp;
+}
+
+
+/*
+ * Records the time since `latency_begin()` for `sink`. Called on the
+ * output thread, right after the event was handed to the kernel.
+ */
+void latency_end( int sink )
+{
+    if (sink < 0 || sink >= LATENCY_SINKS || !started) return;
+
+    const uint64_t now = latency_now();
+    const uint64_t elapsed = now > started ? now - started : 0;
+
+    latency_histogram_t * histogram = &histograms[ sink ];
+    histogram->count++;
+    histogram->sum += elapsed;
+    if (elapsed > histogram->max) histogram->max = elapsed;
+
+    histogram->buckets[ latency_bucket( elapsed ) ]++;
+}
+
+
+unsigned long latency_count( int sink )
+{
+    return histograms[ sink ].count;
+}
+
+
+/*
+ * Returns the value below which `fraction` of the samples are.
+ */
+static uint64_t latency_percentile( const latency_histogram_t * histogram, double fraction )
+{
+    const unsigned long wanted = fraction * histogram->count;
+    unsigned long seen = 0;
+
+    for(int bucket=0; bucket<LATENCY_BUCKETS; bucket++)
+    {
+        seen += histogram->buckets[ bucket ];
+        if (seen > wanted)
+        {
+            const uint64_t value = latency_bucket_max( bucket );
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+
+/*
+ * Prints the percentiles of `sink` and a histogram with a row per
+ * power of two.
+ */
+void latency_print( int sink, const char * name )
+{
+    const latency_histogram_t * histogram = &histograms[ sink ];
+
+    printf( "%s: %lu events\n", name, histogram->count );
+    if (!histogram->count) return;
+
+    printf( "  mean  %10.2f us\n", histogram->sum / 1000.0 / histogram->count );
+    printf( "  p50   %10.2f us\n", latency_percentile( histogram, 0.5 ) / 1000.0 );
+    printf( "  p99   %10.2f us\n", latency_percentile( histogram, 0.99 ) / 1000.0 );
+    printf( "  p99.9 %10.2f us\n", latency_percentile( histogram, 0.999 ) / 1000.0 );
+    printf( "  max   %10.2f us\n", histogram->max / 1000.0 );
+
+    // Sum the buckets per power of two.
+    unsigned long rows[ 64 ] = { 0 };
+    unsigned long largest = 0;
+    int first = 63, last = 0;
+
+    for(int bucket=0; bucket<LATENCY_BUCKETS; bucket++)
+    {
+        if (!histogram->buckets[ bucket ]) continue;
+
+        const uint64_t value = latency_bucket_max( bucket );
+        const int row = value ? 63 - __builtin_clzll( value ) : 0;
+
+        rows[ row ] += histogram->buckets[ bucket ];
+        if (rows[ row ] > largest) largest = rows[ row ];
+        if (row < first) first = row;
+        if (row > last) last = row;
+    }
+
+    for(int row=first; row<=last; row++)
+    {
+        char bar[ 41 ];
+        const int width = rows[ row ] * 40 / largest;
+
+        memset( bar, '#', width );
+        bar[ width ] = 0;
+
+        printf( "  < %10.2f us %-40s %lu\n", (2ULL << row) / 1000.0, bar, rows[ row ] );
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Latency probes, only compiled in with -DLATENCY_PROBE (which is what
+ * `make bench-latency` does). The output thread calls LATENCY_BEGIN with
+ * the time the report of the event came in, and the places that hand
+ * something to the kernel call LATENCY_END right after doing so.
+ */
+
+// Where an output event ends up.
+#define LATENCY_UINPUT      0
+#define LATENCY_ALSA        1
+#define LATENCY_SINKS       2
+
+// Every power of two is split up in this many buckets, which keeps
+// the error of a percentile within ~3%.
+#define LATENCY_SUB_BITS    5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS     ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+#ifdef LATENCY_PROBE
+#define LATENCY_BEGIN(timestamp)    latency_begin( timestamp )
+#define LATENCY_END(sink)           latency_end( sink )
+#else
+#define LATENCY_BEGIN(timestamp)    do {} while (0)
+#define LATENCY_END(sink)           do {} while (0)
+#endif
+
+void latency_reset();
+void latency_begin( uint64_t timestamp );
+void latency_end( int sink );
+unsigned long latency_count( int sink );
+void latency_print( int sink, const char * name );
+
+#endif /* _LATENCY_H_ */
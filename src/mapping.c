@@ -2,75 +2,131 @@
 
 // The null key is sent when invalid indices are used, so we can 
 // return a 0-length mapping.
-static mapping_key_t null_key;
+static const mapping_key_t null_key;
 
-static mapping_key_t mapping[ REAL_BUTTON_TOTAL ];
-static mapping_key_t shifted_mapping[ REAL_BUTTON_TOTAL ];
-
-void mapping_init()
+void mapping_init( mapping_t * mapping )
 {
-    memset( &null_key, 0, sizeof null_key );
-    
-    for(int i=0; i<REAL_BUTTON_TOTAL; i++)
-    {
-        mapping[i].length = 0;
-        shifted_mapping[i].length = 0;
-    }
+    memset( mapping, 0, sizeof(mapping_t) );
 }
 
 /* Interestingly, the button index seems to correlate with the button lights 
  * order (at least for 0..21) so that allows us to light only those buttons
  * with actual mappings.
 */
-void mapping_set( int index, mapping_key_t key )
+void mapping_set( mapping_t * mapping, int layer, int index, mapping_key_t key )
 {
-    if (index >= 0 && index < REAL_BUTTON_TOTAL)
-        mapping[ index ] = key;
+    if (layer >= 0 && layer < MAPPING_LAYERS && index >= 0 && index < REAL_BUTTON_TOTAL)
+        mapping->layers[ layer ][ index ] = key;
 }
 
-void mapping_set_shifted( int index, mapping_key_t key )
+const mapping_key_t * mapping_get( const mapping_t * mapping, int layer, int index )
 {
-    if (index >= 0 && index < REAL_BUTTON_TOTAL)
-        shifted_mapping[ index ] = key;
+    if (layer >= 0 && layer < MAPPING_LAYERS && index >= 0 && index < REAL_BUTTON_TOTAL)
+        return &mapping->layers[ layer ][ index ];
+    
+    return &null_key;
 }
 
-mapping_key_t mapping_get( int index )
+
+/*
+ * @returns 1 if it is mapped on `layer` (or on any layer if that is -1),
+ * 0 otherwise.
+ */
+int mapping_is_mapped( const mapping_t * mapping, int index, int layer )
 {
-    if (index >= 0 && index < REAL_BUTTON_TOTAL)
-        return mapping[ index ];
+    if (index < 0 || index >= REAL_BUTTON_TOTAL) return 0;
+
+    if (layer >= 0)
+    {
+        return mapping_get( mapping, layer, index )->length > 0 ? 1 : 0;
+    }
+
+    for(int i=0; i<MAPPING_LAYERS; i++)
+    {
+        if (mapping->layers[i][ index ].length > 0) return 1;
+    }
     
-    return null_key;
+    return 0;
 }
 
-mapping_key_t mapping_get_shifted( int index )
+
+/*
+ * @returns 1 if any of the keys of `key` is of `type`, 0 otherwise.
+ */
+int mapping_has_type( const mapping_key_t * key, int type )
 {
-    if (index >= 0 && index < REAL_BUTTON_TOTAL)
-        return shifted_mapping[ index ];
-    
-    return null_key;
+    for(int i=0; i<key->length; i++)
+    {
+        if (key->keys[i].type == type) return 1;
+    }
+
+    return 0;
 }
 
 
 /*
- * @returns 1 if it is in any way mapped, 0 otherwise.
+ * @returns 1 if any button (on any layer) is mapped to something
+ * of `type`, 0 otherwise.
  */
-int mapping_is_mapped( int index, int shifted )
+int mapping_uses_type( const mapping_t * mapping, int type )
 {
-    if (index >= 0 && index < REAL_BUTTON_TOTAL)
+    for(int layer=0; layer<MAPPING_LAYERS; layer++)
     {
-        if (shifted == 1) {
-            // mappings with shift only
-            return (shifted_mapping[ index ].length > 0) ? 1 : 0;
-            
-        } else if (shifted == -1) {
-            // only normal mappings without shift
-            return (mapping[ index ].length > 0) ? 1 : 0;
+        for(int i=0; i<REAL_BUTTON_TOTAL; i++)
+        {
+            if (mapping_has_type( &mapping->layers[ layer ][i], type )) return 1;
         }
-
-        // any mapping at all
-        return (mapping[ index ].length > 0
-                || shifted_mapping[ index ].length > 0) ? 1 : 0;
     }
-    
+
     return 0;
 }
+
+
+/*
+ * @returns the layer `key` switches to, or -1 if it isn't a layer
+ * button.
+ */
+int mapping_layer_key( const mapping_key_t * key )
+{
+    for(int i=0; i<key->length; i++)
+    {
+        if (key->keys[i].type == MAPPING_TYPE_LAYER) return key->keys[i].key;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Parses the name of a layer, `Shift` or `Layer1` and up.
+ *
+ * @returns the layer, or -1 if there is no such layer.
+ */
+int mapping_layer_parse( const char * name )
+{
+    char * end;
+
+    if (strcasecmp( name, "Shift" ) == 0) return MAPPING_LAYER_SHIFT;
+    if (strncasecmp( name, "Layer", 5 ) != 0) return -1;
+
+    const long number = strtol( name + 5, &end, 10 );
+    if (end == name + 5 || *end != '\0') return -1;
+    if (number < 1 || number > MAPPING_LAYERS - MAPPING_LAYER_USER) return -1;
+
+    return MAPPING_LAYER_USER + number - 1;
+}
+
+
+/*
+ * The name of a layer, as `mapping_layer_parse()` takes it.
+ */
+const char * mapping_layer_name( int layer )
+{
+    static char name[ 16 ];
+
+    if (layer == MAPPING_LAYER_SHIFT) return "Shift";
+    if (layer < MAPPING_LAYER_USER || layer >= MAPPING_LAYERS) return "";
+
+    snprintf( name, sizeof name, "Layer%d", layer - MAPPING_LAYER_USER + 1 );
+    return name;
+}
@@ -1,3 +1,5 @@
+#include <stdlib.h>
+#include <strings.h>
 #include <linux/uinput.h>
 
 #ifndef _MAPPING_H_
@@ -5,35 +7,119 @@
 
 // BUTTON_TOTAL is in here.
 #include "button_names.h"
+#include "midi_stuff.h"
 
 // The maximum keys a button can trigger.
 #define MAX_KEYS 4
 
 #define MAPPING_TYPE_KEY        0
 #define MAPPING_TYPE_MMC        1
+#define MAPPING_TYPE_REL        2
+#define MAPPING_TYPE_CC         MIDI_CC
+#define MAPPING_TYPE_NOTE       MIDI_NOTE
+#define MAPPING_TYPE_PC         MIDI_PC
+#define MAPPING_TYPE_LAYER      6
+
+// The layers of mappings: the one without a layer, the SHIFT layer and
+// the layers of `LayerN` buttons (Layer1 is MAPPING_LAYER_USER).
+#define MAPPING_LAYERS          8
+#define MAPPING_LAYER_NONE      0
+#define MAPPING_LAYER_SHIFT     1
+#define MAPPING_LAYER_USER      2
+
+// How a button that the software lit up shows it.
+#define MAPPING_LED_BRIGHT      0
+#define MAPPING_LED_BLINK       1
+#define MAPPING_LED_PULSE       2
+
+// A wheel mapping moves this much per detent, unless the mapping sets
+// `scale`. It is in the REL_WHEEL_HI_RES units, where 120 is one notch
+// of a normal mouse wheel.
+#define MAPPING_REL_SCALE       120
 
 typedef struct mapped_key_t {
     unsigned char type;
     int key;
 } mapped_key_t;
 
+// The maximum number of steps in a dial acceleration curve.
+#define MAX_ACCEL_STEPS 4
+
+/*
+ * When the dial moves a detent faster than `millis` after the previous
+ * one, every detent counts `factor` times.
+ */
+typedef struct accel_step_t {
+    unsigned short millis;
+    unsigned short factor;
+} accel_step_t;
+
 typedef struct mapping_key_t {
     int type;
     int length;
     mapped_key_t keys[ MAX_KEYS ];
+
+    // Options given after a `;` in the mapping file. 
+
+    // The most times a dial mapping is sent per report (0 is the default).
+    int max_events;
+
+    // The acceleration curve of a dial mapping.
+    int accel_length;
+    accel_step_t accel[ MAX_ACCEL_STEPS ];
+
+    // How far a wheel mapping moves per detent (0 is the default).
+    int scale;
+
+    // The MMC device ID the MMC commands are sent to.
+    int mmc_device;
+
+    // Held down, the mapping is sent again after `repeat_delay`
+    // milliseconds, and then `repeat_rate` times per second (0 is off).
+    int repeat_delay;
+    int repeat_rate;
+
+    // A CC is switched on with one press and off with the next,
+    // instead of being on only while the button is held.
+    int toggle;
+
+    // What the software sends to light the button up, when it isn't
+    // what the mapping sends itself (MAPPING_TYPE_KEY is nothing).
+    mapped_key_t led;
+
+    // How the button shows that the software lit it up.
+    int led_style;
+
+    // A layer button switches to its layer with one press and back
+    // with the next, instead of only while it is held.
+    int latch;
 } mapping_key_t;
 
+/*
+ * Everything a mapping file maps, on every layer (MAPPING_LAYER_NONE
+ * is without any). Every keyboard has its own.
+ */
+typedef struct mapping_t {
+    mapping_key_t layers[ MAPPING_LAYERS ][ REAL_BUTTON_TOTAL ];
+} mapping_t;
+
 #define MAP_MMC_KEY(code)   (mapped_key_t){.type=MAPPING_TYPE_MMC, .key=code}
 #define MAP_KEY(code)       (mapped_key_t){.type=MAPPING_TYPE_KEY, .key=code}
+#define MAP_REL(code)       (mapped_key_t){.type=MAPPING_TYPE_REL, .key=code}
+#define MAP_MIDI(kind,packed) (mapped_key_t){.type=kind, .key=packed}
+#define MAP_LAYER(layer)    (mapped_key_t){.type=MAPPING_TYPE_LAYER, .key=layer}
 
-void mapping_init();
+void mapping_init( mapping_t * mapping );
 
-void mapping_set( int index, mapping_key_t key );
-void mapping_set_shifted( int index, mapping_key_t key );
+void mapping_set( mapping_t * mapping, int layer, int index, mapping_key_t key );
+const mapping_key_t * mapping_get( const mapping_t * mapping, int layer, int index );
 
-mapping_key_t mapping_get( int index );
-mapping_key_t mapping_get_shifted( int index );
+int mapping_is_mapped( const mapping_t * mapping, int index, int layer );
+int mapping_has_type( const mapping_key_t * key, int type );
+int mapping_uses_type( const mapping_t * mapping, int type );
+int mapping_layer_key( const mapping_key_t * key );
 
-int mapping_is_mapped( int index, int shifted );
+int mapping_layer_parse( const char * name );
+const char * mapping_layer_name( int layer );
 
 #endif /* _MAPPING_H_*/
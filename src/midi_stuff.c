@@ -0,0 +1,81 @@
+#include "midi_stuff.h"
+
+static const char * TYPE_STRINGS[] = {
+    [ MIDI_CC ]   = "CC",
+    [ MIDI_NOTE ] = "Note",
+    [ MIDI_PC ]   = "PC"
+};
+
+
+/*
+ * Parses a MIDI message, one of:
+ *
+ * CC:<channel>:<controller>[:<value>]
+ * Note:<channel>:<note>[:<velocity>]
+ * PC:<channel>:<program>
+ *
+ * where the channel is 1 to 16 and everything else 0 to 127. The value
+ * of a CC defaults to 127, the velocity of a note to 100.
+ *
+ * Returns the MIDI_ type with the message in `packed`, or -1 if it
+ * isn't one.
+ */
+int midi_parse( const char * key, int * packed )
+{
+    char name[ 8 ];
+    int channel, number, value = -1;
+    char end;
+
+    const int count = sscanf( key, "%7[^:]:%d:%d:%d%c", name, &channel, &number, &value, &end );
+    if (count < 3 || count > 4) return -1;
+
+    int type = -1;
+    for(int i=MIDI_CC; i<=MIDI_PC; i++)
+    {
+        if (strcasecmp( name, TYPE_STRINGS[i] ) == 0) type = i;
+    }
+
+    if (type == -1) return -1;
+
+    if (value == -1)
+    {
+        value = type == MIDI_NOTE ? MIDI_DEFAULT_VELOCITY : MIDI_DEFAULT_VALUE;
+    }
+
+    if (channel < 1 || channel > MIDI_CHANNELS
+        || number < 0 || number > 0x7f
+        || value < 0 || value > 0x7f
+        || (type == MIDI_PC && count == 4)
+        || (type == MIDI_NOTE && value == 0))
+    {
+        return -1;
+    }
+
+    *packed = MIDI_PACK( channel - 1, number, value );
+    return type;
+}
+
+
+/*
+ * Formats the message in a static buffer, the way it is written in
+ * the mapping file.
+ */
+const char * midi_name( int type, int packed )
+{
+    static char name[ 32 ];
+
+    if (type < MIDI_CC || type > MIDI_PC) return INVALID_KEY_OR_BUTTON;
+
+    if (type == MIDI_PC)
+    {
+        snprintf( name, sizeof name, "%s:%d:%d", TYPE_STRINGS[ type ],
+            MIDI_CHANNEL( packed ) + 1, MIDI_NUMBER( packed ) );
+    }
+    else
+    {
+        snprintf( name, sizeof name, "%s:%d:%d:%d", TYPE_STRINGS[ type ],
+            MIDI_CHANNEL( packed ) + 1, MIDI_NUMBER( packed ), MIDI_VALUE( packed ) );
+    }
+
+    return name;
+}
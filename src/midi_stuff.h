@@ -0,0 +1,41 @@
+#ifndef _MIDI_STUFF_H_
+#define _MIDI_STUFF_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+
+// The kinds of MIDI messages a mapping can send, which are
+// also their mapping types.
+#define MIDI_CC             3
+#define MIDI_NOTE           4
+#define MIDI_PC             5
+
+// What is sent when the mapping doesn't say.
+#define MIDI_DEFAULT_VALUE      127
+#define MIDI_DEFAULT_VELOCITY   100
+
+#define MIDI_CHANNELS       16
+
+// The channel (0..15), the controller, note or program and the value
+// or velocity of a message, packed in the key of a mapping.
+#define MIDI_PACK(channel,number,value)  (((channel) << 16) | ((number) << 8) | (value))
+#define MIDI_CHANNEL(key)   (((key) >> 16) & 0x0f)
+#define MIDI_NUMBER(key)    (((key) >> 8) & 0x7f)
+#define MIDI_VALUE(key)     ((key) & 0x7f)
+
+// The status bytes of the channel messages, the channel is or'ed in.
+#define MIDI_STATUS_NOTE_OFF    0x80
+#define MIDI_STATUS_NOTE_ON     0x90
+#define MIDI_STATUS_CC          0xb0
+#define MIDI_STATUS_PC          0xc0
+
+#define MIDI_STATUS_CHANNEL(status)     ((status) & 0x0f)
+#define MIDI_STATUS_KIND(status)        ((status) & 0xf0)
+
+int midi_parse( const char * key, int * packed );
+const char * midi_name( int type, int packed );
+
+#endif /* _MIDI_STUFF_H_ */
@@ -3,23 +3,26 @@
 
 //#define MMC_STOP            0x01
 //#define MMC_PLAY            0x02
+//#define MMC_DEFERRED_PLAY   0x03
 //#define MMC_FORWARD         0x04
 //#define MMC_REWIND          0x05
 //#define MMC_RECORD_STROBE   0x06
 //#define MMC_RECORD_EXIT     0x07
 //#define MMC_RECORD_PAUSE    0x08
+//#define MMC_PAUSE           0x09
 
-static size_t KEY_MAX = 9;
+static size_t KEY_MAX = MMC_COMMANDS;
 static const char * KEY_STRINGS[] = {
     NULL,
     "MMC_Stop",
     "MMC_Play",
-    NULL,
+    "MMC_Deferred_Play",
     "MMC_Forward",
     "MMC_Rewind",
     "MMC_Record_Strobe",
     "MMC_Record_Exit",
-    "MMC_Record_Pause"
+    "MMC_Record_Pause",
+    "MMC_Pause"
 };
 
 /*
@@ -54,3 +57,47 @@ const char * mmc_key_name( int command )
     
     return INVALID_KEY_OR_BUTTON;
 }
+
+
+/*
+ * Writes the SysEx for `command` to `device` in `buffer`, which holds
+ * MMC_SYSEX_SZ bytes.
+ *
+ * From https://en.wikipedia.org/wiki/MIDI_Machine_Control
+ *
+ * F0 7F <Device-ID> <Sub-ID#1> [<Sub-ID#2> [<parameters>]] F7
+ *
+ * where Device-ID is the MMC device's ID#; value 00-7F (7F = all
+ * devices); AKA "channel number".
+ */
+void mmc_encode( unsigned char * buffer, int device, int command )
+{
+    buffer[0] = 0xf0;
+    buffer[1] = 0x7f;
+    buffer[2] = device & 0x7f;
+    buffer[3] = 0x06;
+    buffer[4] = command;
+    buffer[5] = 0xf7;
+}
+
+
+/*
+ * The other way around, for any device ID.
+ *
+ * Returns the command, or -1 if `buffer` isn't an MMC command we know.
+ */
+int mmc_decode( const unsigned char * buffer, int length )
+{
+    if (length != MMC_SYSEX_SZ
+        || buffer[0] != 0xf0
+        || buffer[1] != 0x7f
+        || buffer[3] != 0x06
+        || buffer[5] != 0xf7
+        || buffer[4] >= MMC_COMMANDS
+        || KEY_STRINGS[ buffer[4] ] == NULL)
+    {
+        return -1;
+    }
+
+    return buffer[4];
+}
@@ -9,14 +9,28 @@
 
 #define MMC_STOP            0x01
 #define MMC_PLAY            0x02
+#define MMC_DEFERRED_PLAY   0x03
 #define MMC_FORWARD         0x04
 #define MMC_REWIND          0x05
 
 #define MMC_RECORD_STROBE   0x06
 #define MMC_RECORD_EXIT     0x07
 #define MMC_RECORD_PAUSE    0x08
+#define MMC_PAUSE           0x09
+
+// The commands are below this.
+#define MMC_COMMANDS        10
+
+// Device IDs go up to 0x7f, which addresses all devices.
+#define MMC_DEVICES         0x80
+#define MMC_DEVICE_ALL      0x7f
+
+// F0 7F <Device-ID> 06 <command> F7
+#define MMC_SYSEX_SZ        6
 
 int mmc_key_parse( char * key );
 const char * mmc_key_name( int command );
+void mmc_encode( unsigned char * buffer, int device, int command );
+int mmc_decode( const unsigned char * buffer, int length );
 
 #endif /* _MMC_STUFF_H_ */
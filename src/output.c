@@ -0,0 +1,676 @@
+#include "output.h"
+
+/*
+ * The output side. The input thread only decodes reports and pushes
+ * output events into the ring, the output thread takes them out and does
+ * the (possibly slow) uinput writes, ALSA sends and HID LED writes. A
+ * slow LED write therefore never delays reading the next report.
+ */
+
+static ring_t ring;
+
+// The output thread runs its own loop, woken up through `wakeup_fd`.
+static evloop_t output_loop;
+static pthread_t output_thread;
+static int started = 0;
+static int wakeup_fd = -1;
+
+// Set by the output thread right before it goes to sleep, so the
+// input thread only pays for a wake-up when it is actually needed.
+static _Atomic int sleeping = 0;
+
+// Set by `output_stop()`, the loop is stopped once the animations that
+// are playing are over.
+static _Atomic int stopping = 0;
+static int finishing = 0;
+
+static output_sink_t keys = { .fd = -1 };
+static output_sink_t wheels = { .fd = -1 };
+static output_leds_t leds_handler = NULL;
+
+// The MMC commands and MIDI messages of a report are sent together,
+// when the next report starts or the ring is empty.
+static uint64_t alsa_timestamp = 0;
+
+// The wheel movement that didn't add up to a whole notch yet, for
+// REL_WHEEL and REL_HWHEEL.
+static int wheel_remainder[ 2 ];
+
+// The layer the LEDs of every keyboard are to be drawn for next
+// (-1 if they are up to date), and when they were drawn last. Only the
+// last of the OUTPUT_LEDS events in between is drawn, by `led_timer`
+// once a frame is due.
+static int leds_pending[ HID_MAX_DEVICES ];
+static uint64_t leds_drawn[ HID_MAX_DEVICES ];
+static int led_timer = -1;
+
+// The OUTPUT_FREE events in the ring, at most OUTPUT_FREES_MAX.
+static _Atomic unsigned int frees_waiting = 0;
+
+// Armed while uinput has events pending, to retry them.
+static int retry_timer = -1;
+static int retry_armed = 0;
+static unsigned long led_events = 0;
+static unsigned long led_frames = 0;
+
+
+static void output_flush_sink( output_sink_t * sink );
+
+
+/*
+ * Sends the movement in REL_WHEEL_HI_RES units, and the notches it adds
+ * up to for the programs that only know REL_WHEEL.
+ */
+static void output_wheel( int code, int value )
+{
+    int * remainder = &wheel_remainder[ code == REL_HWHEEL ];
+
+    *remainder += value;
+    const int notches = *remainder / MAPPING_REL_SCALE;
+    *remainder -= notches * MAPPING_REL_SCALE;
+
+    uinput_batch_rel( &wheels.batch, code == REL_HWHEEL ? REL_HWHEEL_HI_RES : REL_WHEEL_HI_RES, value );
+    if (notches != 0) uinput_batch_rel( &wheels.batch, code, notches );
+}
+
+
+/*
+ * Sends a MIDI message of a mapping, where a CC that is switched off
+ * goes to 0 and a note that is switched off is released.
+ */
+static void output_midi( int type, int key, int on, uint64_t timestamp )
+{
+    const int channel = MIDI_CHANNEL( key );
+    const int number = MIDI_NUMBER( key );
+
+    switch (type)
+    {
+        case MAPPING_TYPE_CC:
+            alsa_queue_cc( channel, number, on ? MIDI_VALUE( key ) : 0, timestamp );
+            break;
+
+        case MAPPING_TYPE_NOTE:
+            alsa_queue_note( channel, number, on ? MIDI_VALUE( key ) : 0, timestamp );
+            break;
+
+        case MAPPING_TYPE_PC:
+            alsa_queue_pc( channel, number, timestamp );
+            break;
+    }
+}
+
+
+/*
+ * Sends the encoded MIDI messages of an action.
+ */
+static void output_action_midi( const action_midi_t * midi, int count, uint64_t timestamp )
+{
+    for(int i=0; i<count; i++)
+    {
+        const int channel = MIDI_STATUS_CHANNEL( midi[i].status );
+
+        switch (MIDI_STATUS_KIND( midi[i].status ))
+        {
+            case MIDI_STATUS_CC:
+                alsa_queue_cc( channel, midi[i].data[0], midi[i].data[1], timestamp );
+                break;
+
+            case MIDI_STATUS_NOTE_ON:
+            case MIDI_STATUS_NOTE_OFF:
+                alsa_queue_note( channel, midi[i].data[0], midi[i].data[1], timestamp );
+                break;
+
+            case MIDI_STATUS_PC:
+                alsa_queue_pc( channel, midi[i].data[0], timestamp );
+                break;
+        }
+    }
+}
+
+
+/*
+ * Sends what a press or release of a button does: its keys go into the
+ * batch in one go, its MMC commands and MIDI messages to ALSA.
+ */
+static void output_action( const action_t * action, int press, uint64_t timestamp )
+{
+    if (action->key_count > 0)
+    {
+        uinput_batch_keys( &keys.batch, press ? action->press : action->release, action->key_count );
+        keys.timestamp = timestamp;
+    }
+
+    if (press)
+    {
+        for(int i=0; i<action->mmc_count; i++)
+        {
+            alsa_queue_mmc( action->mmc[i], action->mmc_device, timestamp );
+        }
+
+        output_action_midi( action->midi_press, action->midi_press_count, timestamp );
+    }
+    else
+    {
+        output_action_midi( action->midi_release, action->midi_release_count, timestamp );
+    }
+
+    alsa_timestamp = timestamp;
+}
+
+
+static void output_dispatch( const output_event_t * event )
+{
+    // The keys of the previous report go out first, and before
+    // anything that isn't a key (so a held modifier is down before
+    // the wheel moves). The same goes for the wheels.
+    if ((event->type != OUTPUT_KEY && event->type != OUTPUT_ACTION)
+        || event->timestamp != keys.timestamp)
+    {
+        output_flush_sink( &keys );
+    }
+
+    if (event->type != OUTPUT_REL || event->timestamp != wheels.timestamp)
+    {
+        output_flush_sink( &wheels );
+    }
+
+    if (event->timestamp != alsa_timestamp)
+    {
+        alsa_flush();
+    }
+
+    LATENCY_BEGIN( event->timestamp );
+
+    switch (event->type)
+    {
+        case OUTPUT_KEY:
+            uinput_batch_key( &keys.batch, event->code, event->press );
+            keys.timestamp = event->timestamp;
+            break;
+
+        case OUTPUT_MMC:
+            alsa_queue_mmc( event->code, event->press, event->timestamp );
+            alsa_timestamp = event->timestamp;
+            break;
+
+        case OUTPUT_MIDI:
+            output_midi( event->code, event->value, event->press, event->timestamp );
+            alsa_timestamp = event->timestamp;
+            break;
+
+        case OUTPUT_LEDS:
+            if (event->code < HID_MAX_DEVICES) leds_pending[ event->code ] = event->press;
+            led_events++;
+            break;
+
+        case OUTPUT_ACTION:
+            output_action( event->action, event->press, event->timestamp );
+            break;
+
+        case OUTPUT_ANIMATE:
+            animation_play( event->code, event->press, -1 );
+            break;
+
+        case OUTPUT_FREE:
+            free( event->pointer );
+            atomic_fetch_sub( &frees_waiting, 1 );
+            break;
+
+        case OUTPUT_REL:
+            if (wheels.fd < 0) break;
+
+            output_wheel( event->code, event->value );
+            wheels.timestamp = event->timestamp;
+            break;
+    }
+}
+
+
+/*
+ * Draws the LEDs of the keyboards that have a frame due, and sets the
+ * timer for the others.
+ */
+static void output_draw_leds()
+{
+    const uint64_t now = evloop_now();
+    uint64_t next = 0;
+
+    for(int device=0; device<HID_MAX_DEVICES; device++)
+    {
+        if (leds_pending[ device ] < 0) continue;
+
+        const uint64_t due = leds_drawn[ device ] + OUTPUT_LED_FRAME_NS;
+        if (due > now)
+        {
+            if (next == 0 || due < next) next = due;
+            continue;
+        }
+
+        if (leds_handler) leds_handler( device, leds_pending[ device ] );
+
+        leds_pending[ device ] = -1;
+        leds_drawn[ device ] = now;
+        led_frames++;
+    }
+
+    if (next) evloop_timer_set_at( led_timer, next );
+}
+
+
+static void output_on_led_timer( int fd, unsigned int events, void * data )
+{
+    output_draw_leds();
+}
+
+
+/*
+ * Arms `retry_timer` for as long as uinput has events pending, and
+ * disarms it once they are all taken. Waiting for EPOLLOUT instead
+ * would spin, as uinput always says it is writable.
+ */
+static void output_schedule_retry()
+{
+    const int pending = (keys.fd > -1 && uinput_batch_pending( &keys.batch ) > 0)
+        || (wheels.fd > -1 && uinput_batch_pending( &wheels.batch ) > 0);
+
+    if (pending && !retry_armed)
+    {
+        retry_armed = evloop_timer_set( retry_timer, OUTPUT_RETRY_MS, OUTPUT_RETRY_MS ) == 0;
+    }
+    else if (!pending && retry_armed)
+    {
+        evloop_timer_set( retry_timer, 0, 0 );
+        retry_armed = 0;
+    }
+}
+
+
+static void output_on_retry_timer( int fd, unsigned int events, void * data )
+{
+    if (keys.fd > -1) uinput_batch_retry( &keys.batch );
+    if (wheels.fd > -1) uinput_batch_retry( &wheels.batch );
+
+    output_schedule_retry();
+}
+
+
+static void output_flush_sink( output_sink_t * sink )
+{
+    if (sink->fd < 0) return;
+
+    uinput_batch_flush( &sink->batch );
+}
+
+
+static void output_init_sink( output_sink_t * sink, int fd )
+{
+    sink->fd = fd;
+    sink->timestamp = 0;
+
+    uinput_batch_init( &sink->batch, fd );
+}
+
+
+/*
+ * Handles everything that is in the ring, and only goes back to sleep
+ * once it is certain the ring is empty.
+ */
+static void output_drain()
+{
+    output_event_t event;
+
+    for(;;)
+    {
+        while (ring_pop( &ring, &event ))
+        {
+            output_dispatch( &event );
+        }
+
+        output_flush_sink( &keys );
+        output_flush_sink( &wheels );
+        output_schedule_retry();
+
+        alsa_flush();
+
+        // The LEDs go last, they are the least urgent.
+        output_draw_leds();
+
+        atomic_store( &sleeping, 1 );
+        atomic_thread_fence( memory_order_seq_cst );
+        if (ring_depth( &ring ) == 0) return;
+
+        atomic_store( &sleeping, 0 );
+    }
+}
+
+
+static void output_on_wakeup( int fd, unsigned int events, void * data )
+{
+    uint64_t value;
+    if (read( fd, &value, sizeof value ) < 0) return;
+
+    output_drain();
+
+    if (atomic_load( &stopping ) && !finishing)
+    {
+        finishing = 1;
+        if (animation_finish() == 0) evloop_stop( &output_loop );
+    }
+}
+
+
+static void * output_run( void * arg )
+{
+    output_drain();
+    evloop_run( &output_loop );
+
+    // Whatever was pushed before stopping still goes out, so
+    // no key is left pressed.
+    atomic_store( &sleeping, 0 );
+    output_drain();
+
+    for(int i=0; i<OUTPUT_RETRY_ATTEMPTS
+        && (uinput_batch_retry( &keys.batch ) > 0 || uinput_batch_retry( &wheels.batch ) > 0); i++)
+    {
+        usleep( OUTPUT_RETRY_USECS );
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Starts the output thread.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int output_start( int fd, int fd_rel, output_leds_t leds )
+{
+    leds_handler = leds;
+
+    output_init_sink( &keys, fd );
+    output_init_sink( &wheels, fd_rel );
+    memset( wheel_remainder, 0, sizeof wheel_remainder );
+
+    for(int device=0; device<HID_MAX_DEVICES; device++)
+    {
+        leds_pending[ device ] = -1;
+        leds_drawn[ device ] = 0;
+    }
+
+    if (ring_init( &ring, sizeof(output_event_t), OUTPUT_RING_SZ, OUTPUT_RING_RESERVE ) < 0)
+    {
+        return -1;
+    }
+
+    if (evloop_init( &output_loop ) < 0)
+    {
+        ring_free( &ring );
+        return -1;
+    }
+
+    led_timer = evloop_timer_new( &output_loop, output_on_led_timer, NULL );
+    retry_timer = evloop_timer_new( &output_loop, output_on_retry_timer, NULL );
+    retry_armed = 0;
+    atomic_store( &stopping, 0 );
+    atomic_store( &frees_waiting, 0 );
+    finishing = 0;
+
+    wakeup_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if (wakeup_fd < 0 || led_timer < 0 || retry_timer < 0
+        || animation_init( &output_loop, OUTPUT_LED_FRAME_NS ) < 0
+        || evloop_add( &output_loop, wakeup_fd, EPOLLIN, output_on_wakeup, NULL ) < 0
+        || pthread_create( &output_thread, NULL, output_run, NULL ) != 0)
+    {
+        if (wakeup_fd > -1) close( wakeup_fd );
+        wakeup_fd = -1;
+
+        // Closes the timers as well.
+        animation_exit();
+        evloop_exit( &output_loop );
+        led_timer = -1;
+        retry_timer = -1;
+        ring_free( &ring );
+        return -1;
+    }
+
+    started = 1;
+    return 0;
+}
+
+
+/*
+ * Sends everything that is still pending, waits for the animations that
+ * don't repeat to end (like ANIMATION_STOP) and stops the output thread.
+ */
+void output_stop()
+{
+    const uint64_t one = 1;
+
+    if (!started) return;
+
+    atomic_store( &stopping, 1 );
+    if (write( wakeup_fd, &one, sizeof one ) < 0)
+    {
+        // Without the wake-up, it would never stop.
+        perror( "output wakeup" );
+        evloop_stop( &output_loop );
+    }
+
+    pthread_join( output_thread, NULL );
+
+    animation_exit();
+    evloop_exit( &output_loop );
+    close( wakeup_fd );
+    wakeup_fd = -1;
+    led_timer = -1;
+    retry_timer = -1;
+
+    ring_free( &ring );
+    started = 0;
+}
+
+
+/*
+ * Queues an event. Presses, wheel movements and LED frames are dropped
+ * when the ring is full. A release (or a free) that isn't `droppable`
+ * can also take the reserved slots, which never waits: the callers keep
+ * to OUTPUT_RELEASES_MAX and OUTPUT_FREES_MAX, so those can't run out.
+ *
+ * Returns -1 if it was dropped, 0 otherwise.
+ */
+static int output_enqueue( const output_event_t * event, int droppable )
+{
+    return droppable ? ring_push( &ring, event ) : ring_push_reserved( &ring, event );
+}
+
+
+/*
+ * Queues an output event, which is dropped if the ring is full (the
+ * keys of a button go with `output_push_action()`). Called from the
+ * input thread only.
+ *
+ * Returns -1 if it was dropped, 0 otherwise.
+ */
+int output_push( unsigned char type, unsigned short code, unsigned char press, uint64_t timestamp )
+{
+    if (!started) return 0;
+
+    const output_event_t event = {
+        .type = type,
+        .press = press,
+        .code = code,
+        .timestamp = timestamp
+    };
+
+    return output_enqueue( &event, 1 );
+}
+
+
+/*
+ * Queues a wheel movement. Called from the input thread only.
+ *
+ * Returns -1 if it was dropped, 0 otherwise.
+ */
+int output_push_rel( unsigned short code, int value, uint64_t timestamp )
+{
+    if (!started) return 0;
+
+    const output_event_t event = {
+        .type = OUTPUT_REL,
+        .code = code,
+        .value = value,
+        .timestamp = timestamp
+    };
+
+    return output_enqueue( &event, 1 );
+}
+
+
+/*
+ * Queues a MIDI message of a mapping, the CC of a toggle. Switching it
+ * off is a press as well, so it is dropped like one. Called from the
+ * input thread only.
+ *
+ * Returns -1 if it was dropped, 0 otherwise.
+ */
+int output_push_midi( unsigned short type, int key, unsigned char on, uint64_t timestamp )
+{
+    if (!started) return 0;
+
+    const output_event_t event = {
+        .type = OUTPUT_MIDI,
+        .press = on,
+        .code = type,
+        .value = key,
+        .timestamp = timestamp
+    };
+
+    return output_enqueue( &event, 1 );
+}
+
+
+/*
+ * Queues a press or release of a button, as a single event however much
+ * it does. The action has to stay around until the output thread is
+ * done with it. A release is never dropped, so it may only be queued
+ * once its press was. Called from the input thread only.
+ *
+ * Returns -1 if it was dropped, 0 otherwise.
+ */
+int output_push_action( const action_t * action, unsigned char press, uint64_t timestamp )
+{
+    if (!started) return 0;
+
+    const output_event_t event = {
+        .type = OUTPUT_ACTION,
+        .press = press,
+        .action = action,
+        .timestamp = timestamp
+    };
+
+    return output_enqueue( &event, press );
+}
+
+
+/*
+ * @returns 1 if `count` more frees can be queued, 0 if they would have
+ * to wait until the output thread is done with the ones before.
+ */
+int output_can_free( int count )
+{
+    return atomic_load( &frees_waiting ) + count <= OUTPUT_FREES_MAX;
+}
+
+
+/*
+ * Queues the freeing of something the events before it (or the LED
+ * handler) may still use, like a mapping that was replaced. Called
+ * from the input thread only, and freed right away if the output
+ * thread isn't running.
+ *
+ * Returns -1 if OUTPUT_FREES_MAX are waiting already (the caller keeps
+ * `pointer` then), 0 otherwise.
+ */
+int output_push_free( void * pointer, uint64_t timestamp )
+{
+    if (!started)
+    {
+        free( pointer );
+        return 0;
+    }
+
+    if (!output_can_free( 1 )) return -1;
+
+    const output_event_t event = {
+        .type = OUTPUT_FREE,
+        .pointer = pointer,
+        .timestamp = timestamp
+    };
+
+    // Counted before the output thread can take it out again.
+    atomic_fetch_add( &frees_waiting, 1 );
+    if (output_enqueue( &event, 0 ) == 0) return 0;
+
+    atomic_fetch_sub( &frees_waiting, 1 );
+    return -1;
+}
+
+
+/*
+ * Wakes up the output thread if it is sleeping. Called from the input
+ * thread once all events of a report have been pushed.
+ */
+void output_flush()
+{
+    const uint64_t one = 1;
+
+    if (started && atomic_exchange( &sleeping, 0 ))
+    {
+        if (write( wakeup_fd, &one, sizeof one ) < 0)
+        {
+            perror( "output wakeup" );
+        }
+    }
+}
+
+
+/*
+ * Waits until the output thread has taken everything out of the ring.
+ * Only meant for replaying recordings as fast as possible, where the
+ * input side would otherwise overrun the ring.
+ */
+void output_wait_idle()
+{
+    while (started && ring_depth( &ring ) > 0)
+    {
+        sched_yield();
+    }
+}
+
+
+/*
+ * Prints the ring counters.
+ */
+void output_print_stats()
+{
+    printf( "Output queue: %u pending, %u max depth, %lu overflows.\n",
+        ring_depth( &ring ),
+        ring_high_water( &ring ),
+        ring_overflows( &ring ) );
+
+    printf( "uinput: %d pending, %lu retried writes, %lu dropped key events.\n",
+        uinput_batch_pending( &keys.batch ),
+        keys.batch.retries,
+        keys.batch.drops );
+
+    printf( "LEDs: %lu updates drawn in %lu frames.\n", led_events, led_frames );
+
+    if (wheels.fd > -1)
+    {
+        printf( "Wheels: %d pending, %lu retried writes, %lu dropped events.\n",
+            uinput_batch_pending( &wheels.batch ),
+            wheels.batch.retries,
+            wheels.batch.drops );
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+#include "ring.h"
+#include "event_loop.h"
+#include "uinput_stuff.h"
+#include "mapping.h"
+#include "alsa.h"
+#include "latency.h"
+#include "hid.h"
+#include "animation.h"
+#include "action.h"
+
+// The number of pending output events, must be a power of two.
+#define OUTPUT_RING_SZ      1024
+
+// The most releases that can be waiting in the ring beyond its other
+// events. A release is only queued once its press was, so this is one
+// for every button that is held down plus the tap in progress, with
+// room to spare.
+#define OUTPUT_RELEASES_MAX     (2 * REAL_BUTTON_TOTAL * HID_MAX_DEVICES)
+
+// The most frees that can be waiting, for a reload of every keyboard.
+#define OUTPUT_FREES_MAX        (2 * HID_MAX_DEVICES)
+
+// The slots of the ring only releases and frees can take, so a full
+// ring drops presses rather than leave a key held down. As both are
+// bounded above, these can't run out.
+#define OUTPUT_RING_RESERVE     (OUTPUT_RELEASES_MAX + OUTPUT_FREES_MAX)
+
+// How long the output thread keeps trying to hand the pending uinput
+// events over when it stops.
+#define OUTPUT_RETRY_ATTEMPTS   100
+#define OUTPUT_RETRY_USECS      1000
+
+// While uinput doesn't take the pending events, they are retried this
+// often. uinput is always writable as far as poll() is concerned.
+#define OUTPUT_RETRY_MS         2
+
+// The LEDs of a keyboard are redrawn at most this many times per second,
+// whatever comes in between is drawn with the next frame.
+#define OUTPUT_LED_FPS          50
+#define OUTPUT_LED_FRAME_NS     (1000000000ULL / OUTPUT_LED_FPS)
+
+// Output event types.
+#define OUTPUT_KEY          0
+#define OUTPUT_MMC          1
+#define OUTPUT_LEDS         2
+#define OUTPUT_REL          3
+#define OUTPUT_MIDI         4
+#define OUTPUT_ANIMATE      5
+#define OUTPUT_ACTION       6
+#define OUTPUT_FREE         7
+
+/*
+ * A single thing the output thread has to do. For OUTPUT_KEY `code` is
+ * the key and `press` is 1 or 0, for OUTPUT_MMC `code` is the command and
+ * `press` the MMC device ID, and for OUTPUT_LEDS `code` is the keyboard
+ * (below HID_MAX_DEVICES) and `press` is the layer to light up for. For OUTPUT_REL `code`
+ * is the wheel (REL_WHEEL or REL_HWHEEL) and `value` how far it moves,
+ * in REL_WHEEL_HI_RES units. For OUTPUT_MIDI `code` is the mapping type
+ * (MAPPING_TYPE_CC, _NOTE or _PC), `value` the packed message and `press`
+ * whether it is switched on or off. For OUTPUT_ANIMATE `code` is the HID
+ * device and `press` the animation (ANIMATION_START or ANIMATION_STOP).
+ * For OUTPUT_ACTION `action` is what a button does and `press` whether
+ * it is pressed or released. For OUTPUT_FREE `pointer` is freed, once
+ * the events before it are done with it.
+ *
+ * The `timestamp` is the CLOCK_MONOTONIC time the report that caused
+ * it came in.
+ */
+typedef struct output_event_t {
+    unsigned char type;
+    unsigned char press;
+    unsigned short code;
+    union {
+        int value;
+        const action_t * action;
+        void * pointer;
+    };
+    uint64_t timestamp;
+} output_event_t;
+
+/*
+ * A uinput device the output thread writes to, the keyboard or the
+ * wheels.
+ */
+typedef struct output_sink_t {
+    int fd; // -1 if there is none
+
+    // The events of a report are written together, the batch is
+    // flushed when the next report starts or the ring is empty.
+    uinput_batch_t batch;
+    uint64_t timestamp;
+} output_sink_t;
+
+// Called on the output thread to update the LEDs of a HID device.
+typedef void (*output_leds_t)( int device, int layer );
+
+int output_start( int fd_uinput, int fd_rel, output_leds_t leds );
+void output_stop();
+
+int output_push( unsigned char type, unsigned short code, unsigned char press, uint64_t timestamp );
+int output_push_rel( unsigned short code, int value, uint64_t timestamp );
+int output_push_midi( unsigned short type, int key, unsigned char on, uint64_t timestamp );
+int output_push_action( const action_t * action, unsigned char press, uint64_t timestamp );
+int output_can_free( int count );
+int output_push_free( void * pointer, uint64_t timestamp );
+void output_flush();
+void output_wait_idle();
+
+void output_print_stats();
+
+#endif /* _OUTPUT_H_ */
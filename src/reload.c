@@ -0,0 +1,308 @@
+#include "reload.h"
+
+/*
+ * Watches the mapping files with inotify, and reads and compiles the
+ * ones that changed on a thread of its own, so the keyboards keep
+ * working while that happens. The directories are watched rather than
+ * the files, as most editors save by replacing the file.
+ */
+
+typedef struct reload_file_t {
+    char * path;
+    char * name; // without the directory, as inotify reports it
+    int wd;
+
+    // Changed since it was read last, and being read by the thread.
+    int queued;
+    int reading;
+
+    // What the thread read, NULL if it couldn't.
+    mapping_t * mapping;
+    action_table_t * actions;
+} reload_file_t;
+
+static reload_file_t files[ RELOAD_MAX_FILES ];
+
+static int reload_fd = -1;
+static int reload_timer = -1;
+static int done_fd = -1;
+
+static pthread_t reader;
+static int reader_busy = 0;
+
+static reload_handler_t reload_handler = NULL;
+static void * reload_data = NULL;
+
+
+/*
+ * The reader thread: reads and compiles every file that is `reading`,
+ * and tells the event loop when it is done. Nothing else touches those
+ * files until it is joined.
+ */
+static void * reload_run( void * data )
+{
+    for(int i=0; i<RELOAD_MAX_FILES; i++)
+    {
+        reload_file_t * file = &files[i];
+        if (!file->reading) continue;
+
+        file->actions = NULL;
+        file->mapping = malloc( sizeof(mapping_t) );
+        if (!file->mapping) continue;
+
+        mapping_init( file->mapping );
+
+        if (config_read( file->mapping, file->path, 0 ) == 0)
+        {
+            file->actions = action_compile( file->mapping );
+        }
+
+        if (!file->actions)
+        {
+            free( file->mapping );
+            file->mapping = NULL;
+        }
+    }
+
+    const uint64_t one = 1;
+    if (write( done_fd, &one, sizeof one ) < 0) perror( "reload" );
+
+    return NULL;
+}
+
+
+/*
+ * Starts reading the files that changed, unless they are being read
+ * already (they are read again once that is done).
+ */
+static void reload_on_timer( int fd, unsigned int events, void * data )
+{
+    int count = 0;
+
+    if (reader_busy) return;
+
+    for(int i=0; i<RELOAD_MAX_FILES; i++)
+    {
+        files[i].reading = files[i].queued;
+        files[i].queued = 0;
+        count += files[i].reading;
+    }
+
+    if (count == 0) return;
+
+    if (pthread_create( &reader, NULL, reload_run, NULL ) != 0)
+    {
+        printf( "The changed mapping could not be read.\n" );
+        for(int i=0; i<RELOAD_MAX_FILES; i++) files[i].reading = 0;
+        return;
+    }
+
+    reader_busy = 1;
+}
+
+
+/*
+ * Hands what the reader thread read to the handler.
+ */
+static void reload_on_done( int fd, unsigned int events, void * data )
+{
+    uint64_t count;
+    int queued = 0;
+
+    if (read( fd, &count, sizeof count ) < 0 || !reader_busy) return;
+
+    pthread_join( reader, NULL );
+    reader_busy = 0;
+
+    for(int i=0; i<RELOAD_MAX_FILES; i++)
+    {
+        reload_file_t * file = &files[i];
+
+        if (file->reading && file->mapping
+            && reload_handler( i, file->mapping, file->actions, reload_data ) < 0)
+        {
+            // Not now, it is read again with the next timer.
+            action_free( file->actions );
+            free( file->mapping );
+            file->queued = 1;
+        }
+        else if (file->reading && !file->mapping)
+        {
+            printf( "The mapping file `%s` could not be read, the old mapping is kept.\n", file->path );
+        }
+
+        file->reading = 0;
+        file->mapping = NULL;
+        file->actions = NULL;
+
+        queued |= file->queued;
+    }
+
+    // It changed again while it was being read, or wasn't taken yet.
+    if (queued) evloop_timer_set( reload_timer, RELOAD_DELAY_MS, 0 );
+}
+
+
+static void reload_on_readable( int fd, unsigned int events, void * data )
+{
+    char buffer[ RELOAD_BUFFER_SZ ] __attribute__((aligned( __alignof__(struct inotify_event) )));
+
+    for(;;)
+    {
+        const ssize_t length = read( fd, buffer, sizeof buffer );
+        if (length <= 0) return;
+
+        for(char * p = buffer; p < buffer + length; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+        {
+            const struct inotify_event * event = (const struct inotify_event *)p;
+            if (event->len == 0) continue;
+
+            for(int i=0; i<RELOAD_MAX_FILES; i++)
+            {
+                if (files[i].path && files[i].wd == event->wd && strcmp( files[i].name, event->name ) == 0)
+                {
+                    files[i].queued = 1;
+                    evloop_timer_set( reload_timer, RELOAD_DELAY_MS, 0 );
+                }
+            }
+        }
+    }
+}
+
+
+/*
+ * Starts watching for changes of the mapping files, `handler` is called
+ * from the event loop with what they map then. The files themselves are
+ * added by `reload_watch()`.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int reload_open( evloop_t * loop, reload_handler_t handler, void * data )
+{
+    reload_handler = handler;
+    reload_data = data;
+
+    reload_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+    done_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    reload_timer = evloop_timer_new( loop, reload_on_timer, NULL );
+
+    if (reload_fd < 0 || done_fd < 0 || reload_timer < 0
+        || evloop_add( loop, reload_fd, EPOLLIN, reload_on_readable, NULL ) < 0
+        || evloop_add( loop, done_fd, EPOLLIN, reload_on_done, NULL ) < 0)
+    {
+        reload_close( loop );
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Stops watching file `index`. Its directory stays watched while
+ * another file in it is (inotify gives them the same watch).
+ */
+static void reload_unwatch( int index )
+{
+    reload_file_t * file = &files[ index ];
+    int shared = 0;
+
+    if (!file->path) return;
+
+    for(int i=0; i<RELOAD_MAX_FILES; i++)
+    {
+        if (i != index && files[i].path && files[i].wd == file->wd) shared = 1;
+    }
+
+    if (!shared) inotify_rm_watch( reload_fd, file->wd );
+
+    free( file->path );
+    free( file->name );
+    file->path = NULL;
+    file->name = NULL;
+    file->queued = 0;
+}
+
+
+/*
+ * Watches the mapping file at `path` as file `index`, instead of the
+ * one it watched before.
+ *
+ * Returns -1 on error (or while that one is being read), 0 if all is well.
+ */
+int reload_watch( int index, const char * path )
+{
+    if (reload_fd < 0 || index < 0 || index >= RELOAD_MAX_FILES) return -1;
+
+    reload_file_t * file = &files[ index ];
+
+    // The reader thread uses its path until it is done.
+    if (file->reading) return -1;
+
+    reload_unwatch( index );
+
+    char * directory = strdup( path );
+    char * name = strdup( path );
+
+    if (!directory || !name)
+    {
+        free( directory );
+        free( name );
+        return -1;
+    }
+
+    file->wd = inotify_add_watch( reload_fd, dirname( directory ), IN_CLOSE_WRITE | IN_MOVED_TO );
+    file->path = strdup( path );
+    file->name = strdup( basename( name ) );
+
+    free( directory );
+    free( name );
+
+    if (file->wd < 0 || !file->path || !file->name)
+    {
+        free( file->path );
+        free( file->name );
+        file->path = NULL;
+        file->name = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void reload_close( evloop_t * loop )
+{
+    // Whatever it is reading is of no use anymore.
+    if (reader_busy)
+    {
+        pthread_join( reader, NULL );
+        reader_busy = 0;
+    }
+
+    for(int i=0; i<RELOAD_MAX_FILES; i++)
+    {
+        action_free( files[i].actions );
+        free( files[i].mapping );
+        free( files[i].path );
+        free( files[i].name );
+        memset( &files[i], 0, sizeof(reload_file_t) );
+    }
+
+    if (reload_timer > -1) evloop_timer_free( loop, reload_timer );
+    reload_timer = -1;
+
+    if (reload_fd > -1)
+    {
+        evloop_remove( loop, reload_fd );
+        close( reload_fd );
+        reload_fd = -1;
+    }
+
+    if (done_fd > -1)
+    {
+        evloop_remove( loop, done_fd );
+        close( done_fd );
+        done_fd = -1;
+    }
+}
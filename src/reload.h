@@ -0,0 +1,42 @@
+#ifndef _RELOAD_H_
+#define _RELOAD_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#include "event_loop.h"
+#include "hid.h"
+#include "mapping.h"
+#include "config.h"
+#include "action.h"
+
+// The mapping files that can be watched, one for every keyboard.
+#define RELOAD_MAX_FILES        HID_MAX_DEVICES
+
+// How long a file has to be left alone before it is read, so an editor
+// that saves in more than one write is only read once.
+#define RELOAD_DELAY_MS         100
+
+// Enough for a few inotify events with a file name each.
+#define RELOAD_BUFFER_SZ        4096
+
+/*
+ * Called on the event loop when the mapping file `index` (as passed to
+ * `reload_watch()`) was changed and read again. The handler owns the
+ * mapping and the actions compiled from it from then on, unless it
+ * returns -1 for it to be read again a little later.
+ */
+typedef int (*reload_handler_t)( int index, mapping_t * mapping, action_table_t * actions, void * data );
+
+int reload_open( evloop_t * loop, reload_handler_t handler, void * data );
+int reload_watch( int index, const char * path );
+void reload_close( evloop_t * loop );
+
+#endif /* _RELOAD_H_ */
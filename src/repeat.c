@@ -0,0 +1,223 @@
+#include "repeat.h"
+
+/*
+ * Auto-repeat for held buttons, run by a single timer in the event loop.
+ *
+ * The repeating buttons are kept in a hashed timer wheel with a slot per
+ * millisecond, so starting, stopping and firing one never has to look at
+ * the others. The timer is only armed for the next slot that has
+ * something due, and not at all when nothing repeats.
+ */
+
+static int timer_fd = -1;
+
+static repeat_entry_t entries[ REPEAT_MAX ];
+static int active_count = 0;
+
+// The first entry of every slot, or -1.
+static int slots[ REPEAT_SLOTS ];
+
+// Every slot before this tick has been handled.
+static uint64_t current_tick = 0;
+
+
+static int repeat_slot( uint64_t deadline )
+{
+    return (deadline / REPEAT_TICK_NS) & (REPEAT_SLOTS - 1);
+}
+
+
+static void repeat_link( int id )
+{
+    const int slot = repeat_slot( entries[ id ].deadline );
+
+    entries[ id ].next = slots[ slot ];
+    slots[ slot ] = id;
+}
+
+
+static void repeat_unlink( int id )
+{
+    int * link = &slots[ repeat_slot( entries[ id ].deadline ) ];
+
+    while (*link != -1)
+    {
+        if (*link == id)
+        {
+            *link = entries[ id ].next;
+            return;
+        }
+
+        link = &entries[ *link ].next;
+    }
+}
+
+
+/*
+ * Arms the timer for the first entry that is due, at most a full turn
+ * of the wheel ahead.
+ */
+static void repeat_arm()
+{
+    if (active_count == 0)
+    {
+        evloop_timer_set( timer_fd, 0, 0 );
+        return;
+    }
+
+    for(uint64_t tick = current_tick; tick < current_tick + REPEAT_SLOTS; tick++)
+    {
+        uint64_t first = 0;
+
+        // Only what is due in this very tick, the rest of the
+        // slot is for a later round.
+        for(int id = slots[ tick & (REPEAT_SLOTS - 1) ]; id != -1; id = entries[ id ].next)
+        {
+            if (entries[ id ].deadline / REPEAT_TICK_NS <= tick
+                && (first == 0 || entries[ id ].deadline < first))
+            {
+                first = entries[ id ].deadline;
+            }
+        }
+
+        if (first)
+        {
+            evloop_timer_set_at( timer_fd, first );
+            return;
+        }
+    }
+
+    // Nothing within a turn, look again after it.
+    evloop_timer_set_at( timer_fd, (current_tick + REPEAT_SLOTS) * REPEAT_TICK_NS );
+}
+
+
+static void repeat_on_timer( int fd, unsigned int events, void * data )
+{
+    int due[ REPEAT_MAX ];
+    int due_count = 0;
+
+    const uint64_t now = evloop_now();
+    const uint64_t now_tick = now / REPEAT_TICK_NS;
+
+    // Take out everything that is due, a full turn at most as that
+    // already visits every slot.
+    uint64_t ticks = now_tick - current_tick + 1;
+    if (now_tick < current_tick) ticks = 0;
+    if (ticks > REPEAT_SLOTS) ticks = REPEAT_SLOTS;
+
+    for(uint64_t tick = current_tick; tick < current_tick + ticks; tick++)
+    {
+        int * link = &slots[ tick & (REPEAT_SLOTS - 1) ];
+
+        while (*link != -1)
+        {
+            const int id = *link;
+
+            if (entries[ id ].deadline <= now)
+            {
+                *link = entries[ id ].next;
+                due[ due_count++ ] = id;
+            }
+            else
+            {
+                link = &entries[ id ].next;
+            }
+        }
+    }
+
+    if (now_tick > current_tick) current_tick = now_tick;
+
+    for(int i=0; i<due_count; i++)
+    {
+        repeat_entry_t * entry = &entries[ due[i] ];
+        const uint64_t deadline = entry->deadline;
+
+        // It is put back before the callback, which may stop it. When
+        // the loop got behind (a suspend) it skips ahead instead of
+        // sending a burst.
+        entry->deadline += entry->interval;
+        if (entry->deadline <= now) entry->deadline = now + entry->interval;
+        repeat_link( due[i] );
+
+        entry->callback( due[i], deadline, entry->data );
+    }
+
+    repeat_arm();
+}
+
+
+/*
+ * Creates the timer in `loop`.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int repeat_init( evloop_t * loop )
+{
+    memset( entries, 0, sizeof entries );
+    for(int i=0; i<REPEAT_SLOTS; i++) slots[i] = -1;
+    active_count = 0;
+
+    timer_fd = evloop_timer_new( loop, repeat_on_timer, NULL );
+    return timer_fd < 0 ? -1 : 0;
+}
+
+
+void repeat_exit( evloop_t * loop )
+{
+    if (timer_fd < 0) return;
+
+    evloop_timer_free( loop, timer_fd );
+    timer_fd = -1;
+}
+
+
+/*
+ * Starts repeating `id` (which is below REPEAT_MAX), first `delay` and
+ * then every `interval` nanoseconds after `timestamp`. Does nothing
+ * without `repeat_init()`.
+ */
+void repeat_start( int id, uint64_t delay, uint64_t interval, uint64_t timestamp, repeat_callback_t callback, void * data )
+{
+    if (timer_fd < 0 || id < 0 || id >= REPEAT_MAX || interval == 0) return;
+
+    repeat_entry_t * entry = &entries[ id ];
+
+    if (entry->active)
+    {
+        repeat_unlink( id );
+    }
+    else
+    {
+        // Nothing was running, so the wheel starts over from here.
+        if (active_count == 0) current_tick = timestamp / REPEAT_TICK_NS;
+        active_count++;
+    }
+
+    entry->active = 1;
+    entry->deadline = timestamp + delay;
+    entry->interval = interval;
+    entry->callback = callback;
+    entry->data = data;
+
+    // The wheel is never behind what it holds.
+    if (entry->deadline / REPEAT_TICK_NS < current_tick)
+    {
+        current_tick = entry->deadline / REPEAT_TICK_NS;
+    }
+
+    repeat_link( id );
+    repeat_arm();
+}
+
+
+void repeat_stop( int id )
+{
+    if (timer_fd < 0 || id < 0 || id >= REPEAT_MAX || !entries[ id ].active) return;
+
+    repeat_unlink( id );
+    entries[ id ].active = 0;
+    active_count--;
+
+    repeat_arm();
+}
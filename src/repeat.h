@@ -0,0 +1,49 @@
+#ifndef _REPEAT_H_
+#define _REPEAT_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "event_loop.h"
+#include "button_names.h"
+#include "hid.h"
+
+// The resolution of the timer wheel.
+#define REPEAT_TICK_NS          1000000ULL
+
+// The number of slots, must be a power of two. Anything further away
+// than a full turn just stays in its slot for another round.
+#define REPEAT_SLOTS            256
+
+// Every button of every keyboard can repeat at the same time.
+#define REPEAT_MAX              (HID_MAX_DEVICES * (REAL_BUTTON_TOTAL))
+
+/*
+ * Called from the event loop every time `id` repeats. The `timestamp`
+ * is when it was due, so the rate doesn't depend on how late the loop
+ * got to it.
+ */
+typedef void (*repeat_callback_t)( int id, uint64_t timestamp, void * data );
+
+typedef struct repeat_entry_t {
+    int active;
+
+    uint64_t deadline;
+    uint64_t interval;
+
+    repeat_callback_t callback;
+    void * data;
+
+    // The next entry in the same slot, or -1.
+    int next;
+} repeat_entry_t;
+
+int repeat_init( evloop_t * loop );
+void repeat_exit( evloop_t * loop );
+
+void repeat_start( int id, uint64_t delay, uint64_t interval, uint64_t timestamp, repeat_callback_t callback, void * data );
+void repeat_stop( int id );
+
+#endif /* _REPEAT_H_ */
@@ -0,0 +1,145 @@
+#include "ring.h"
+
+/*
+ * Sets up a ring that holds `capacity` items of `item_size` bytes, of
+ * which `reserve` are kept for `ring_push_reserved()`. The capacity has
+ * to be a power of two.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int ring_init( ring_t * ring, size_t item_size, unsigned int capacity, unsigned int reserve )
+{
+    memset( ring, 0, sizeof(ring_t) );
+
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 || reserve >= capacity)
+    {
+        return -1;
+    }
+
+    ring->items = calloc( capacity, item_size );
+    if (!ring->items) return -1;
+
+    ring->mask = capacity - 1;
+    ring->reserve = reserve;
+    ring->item_size = item_size;
+
+    atomic_init( &ring->head, 0 );
+    atomic_init( &ring->tail, 0 );
+    atomic_init( &ring->overflows, 0 );
+    atomic_init( &ring->high_water, 0 );
+
+    return 0;
+}
+
+
+void ring_free( ring_t * ring )
+{
+    free( ring->items );
+    ring->items = NULL;
+}
+
+
+/*
+ * Copies `item` in at `head`, if there are more than `keep` slots free.
+ *
+ * Returns -1 if there weren't, 0 otherwise.
+ */
+static int ring_put( ring_t * ring, const void * item, unsigned int keep )
+{
+    const unsigned int head = atomic_load_explicit( &ring->head, memory_order_relaxed );
+    const unsigned int tail = atomic_load_explicit( &ring->tail, memory_order_acquire );
+    const unsigned int depth = head - tail;
+
+    if (depth + keep > ring->mask) return -1;
+
+    memcpy( ring->items + (head & ring->mask) * ring->item_size, item, ring->item_size );
+
+    // Sequentially consistent, so a consumer that is about to go to
+    // sleep either sees this item or the producer sees it sleeping.
+    atomic_store_explicit( &ring->head, head + 1, memory_order_seq_cst );
+
+    if (depth + 1 > atomic_load_explicit( &ring->high_water, memory_order_relaxed ))
+    {
+        atomic_store_explicit( &ring->high_water, depth + 1, memory_order_relaxed );
+    }
+
+    return 0;
+}
+
+
+/*
+ * Adds an item, leaving the reserved slots alone. This never blocks: if
+ * the ring is full the item is dropped and counted as an overflow.
+ *
+ * Returns -1 if the ring was full, 0 otherwise.
+ */
+int ring_push( ring_t * ring, const void * item )
+{
+    if (ring_put( ring, item, ring->reserve ) < 0)
+    {
+        atomic_fetch_add_explicit( &ring->overflows, 1, memory_order_relaxed );
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Adds an item that must not be dropped, which can also take the
+ * reserved slots. If even those are taken, the item is not added and
+ * the caller has to wait for the consumer and try again.
+ *
+ * Returns -1 if the ring was full, 0 otherwise.
+ */
+int ring_push_reserved( ring_t * ring, const void * item )
+{
+    return ring_put( ring, item, 0 );
+}
+
+
+/*
+ * Takes the oldest item.
+ *
+ * Returns 1 if an item was copied to `item`, 0 if the ring is empty.
+ */
+int ring_pop( ring_t * ring, void * item )
+{
+    const unsigned int tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+    const unsigned int head = atomic_load_explicit( &ring->head, memory_order_seq_cst );
+
+    if (head == tail) return 0;
+
+    memcpy( item, ring->items + (tail & ring->mask) * ring->item_size, ring->item_size );
+    atomic_store_explicit( &ring->tail, tail + 1, memory_order_release );
+
+    return 1;
+}
+
+
+/*
+ * The number of items currently waiting.
+ */
+unsigned int ring_depth( ring_t * ring )
+{
+    return atomic_load_explicit( &ring->head, memory_order_relaxed )
+        - atomic_load_explicit( &ring->tail, memory_order_relaxed );
+}
+
+
+/*
+ * The highest depth seen so far.
+ */
+unsigned int ring_high_water( ring_t * ring )
+{
+    return atomic_load_explicit( &ring->high_water, memory_order_relaxed );
+}
+
+
+/*
+ * The number of items dropped because the ring was full.
+ */
+unsigned long ring_overflows( ring_t * ring )
+{
+    return atomic_load_explicit( &ring->overflows, memory_order_relaxed );
+}
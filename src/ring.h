@@ -0,0 +1,44 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+// Keeps the producer and consumer indices on separate cache lines.
+#define RING_CACHE_LINE     64
+
+/*
+ * A wait-free single-producer / single-consumer ring buffer of fixed
+ * size items. Exactly one thread may push and exactly one (other) thread
+ * may pop.
+ */
+typedef struct ring_t {
+    // Written by the producer only.
+    _Atomic unsigned int head __attribute__(( aligned( RING_CACHE_LINE ) ));
+    _Atomic unsigned long overflows;
+    _Atomic unsigned int high_water;
+
+    // Written by the consumer only.
+    _Atomic unsigned int tail __attribute__(( aligned( RING_CACHE_LINE ) ));
+
+    // Read-only after `ring_init()`. The last `reserve` slots are only
+    // taken by `ring_push_reserved()`.
+    unsigned int mask __attribute__(( aligned( RING_CACHE_LINE ) ));
+    unsigned int reserve;
+    size_t item_size;
+    unsigned char * items;
+} ring_t;
+
+int ring_init( ring_t * ring, size_t item_size, unsigned int capacity, unsigned int reserve );
+void ring_free( ring_t * ring );
+
+int ring_push( ring_t * ring, const void * item );
+int ring_push_reserved( ring_t * ring, const void * item );
+int ring_pop( ring_t * ring, void * item );
+
+unsigned int ring_depth( ring_t * ring );
+unsigned int ring_high_water( ring_t * ring );
+unsigned long ring_overflows( ring_t * ring );
+
+#endif /* _RING_H_ */
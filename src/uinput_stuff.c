@@ -1,844 +1,279 @@
 #include "uinput_stuff.h"
 
-#define MAX_KEYS 400
-
-static const char * KEY_STRINGS[] = {
-    "ESC",
-    "1",
-    "2",
-    "3",
-    "4",
-    "5",
-    "6",
-    "7",
-    "8",
-    "9",
-    "0",
-    "MINUS",
-    "EQUAL",
-    "BACKSPACE",
-    "TAB",
-    "Q",
-    "W",
-    "E",
-    "R",
-    "T",
-    "Y",
-    "U",
-    "I",
-    "O",
-    "P",
-    "LEFTBRACE",
-    "RIGHTBRACE",
-    "ENTER",
-    "LEFTCTRL",
-    "A",
-    "S",
-    "D",
-    "F",
-    "G",
-    "H",
-    "J",
-    "K",
-    "L",
-    "SEMICOLON",
-    "APOSTROPHE",
-    "GRAVE",
-    "LEFTSHIFT",
-    "BACKSLASH",
-    "Z",
-    "X",
-    "C",
-    "V",
-    "B",
-    "N",
-    "M",
-    "COMMA",
-    "DOT",
-    "SLASH",
-    "RIGHTSHIFT",
-    "KPASTERISK",
-    "LEFTALT",
-    "SPACE",
-    "CAPSLOCK",
-    "F1",
-    "F2",
-    "F3",
-    "F4",
-    "F5",
-    "F6",
-    "F7",
-    "F8",
-    "F9",
-    "F10",
-    "NUMLOCK",
-    "SCROLLLOCK",
-    "KP7",
-    "KP8",
-    "KP9",
-    "KPMINUS",
-    "KP4",
-    "KP5",
-    "KP6",
-    "KPPLUS",
-    "KP1",
-    "KP2",
-    "KP3",
-    "KP0",
-    "KPDOT",
-    "ZENKAKUHANKAKU",
-    "102ND",
-    "F11",
-    "F12",
-    "RO",
-    "KATAKANA",
-    "HIRAGANA",
-    "HENKAN",
-    "KATAKANAHIRAGANA",
-    "MUHENKAN",
-    "KPJPCOMMA",
-    "KPENTER",
-    "RIGHTCTRL",
-    "KPSLASH",
-    "SYSRQ",
-    "RIGHTALT",
-    "LINEFEED",
-    "HOME",
-    "UP",
-    "PAGEUP",
-    "LEFT",
-    "RIGHT",
-    "END",
-    "DOWN",
-    "PAGEDOWN",
-    "INSERT",
-    "DELETE",
-    "MACRO",
-    "MUTE",
-    "VOLUMEDOWN",
-    "VOLUMEUP",
-    "POWER",
-    "KPEQUAL",
-    "KPPLUSMINUS",
-    "PAUSE",
-    "SCALE",
-    "KPCOMMA",
-    "HANGEUL",
-    "HANGUEL",
-    "HANJA",
-    "YEN",
-    "LEFTMETA",
-    "RIGHTMETA",
-    "COMPOSE",
-    "STOP",
-    "AGAIN",
-    "PROPS",
-    "UNDO",
-    "FRONT",
-    "COPY",
-    "OPEN",
-    "PASTE",
-    "FIND",
-    "CUT",
-    "HELP",
-    "MENU",
-    "CALC",
-    "SETUP",
-    "SLEEP",
-    "WAKEUP",
-    "FILE",
-    "SENDFILE",
-    "DELETEFILE",
-    "XFER",
-    "PROG1",
-    "PROG2",
-    "WWW",
-    "MSDOS",
-    "COFFEE",
-    "SCREENLOCK",
-    "DIRECTION",
-    "CYCLEWINDOWS",
-    "MAIL",
-    "BOOKMARKS",
-    "COMPUTER",
-    "BACK",
-    "FORWARD",
-    "CLOSECD",
-    "EJECTCD",
-    "EJECTCLOSECD",
-    "NEXTSONG",
-    "PLAYPAUSE",
-    "PREVIOUSSONG",
-    "STOPCD",
-    "RECORD",
-    "REWIND",
-    "PHONE",
-    "ISO",
-    "CONFIG",
-    "HOMEPAGE",
-    "REFRESH",
-    "EXIT",
-    "MOVE",
-    "EDIT",
-    "SCROLLUP",
-    "SCROLLDOWN",
-    "KPLEFTPAREN",
-    "KPRIGHTPAREN",
-    "NEW",
-    "REDO",
-    "F13",
-    "F14",
-    "F15",
-    "F16",
-    "F17",
-    "F18",
-    "F19",
-    "F20",
-    "F21",
-    "F22",
-    "F23",
-    "F24",
-    "PLAYCD",
-    "PAUSECD",
-    "PROG3",
-    "PROG4",
-    "DASHBOARD",
-    "SUSPEND",
-    "CLOSE",
-    "PLAY",
-    "FASTFORWARD",
-    "BASSBOOST",
-    "PRINT",
-    "HP",
-    "CAMERA",
-    "SOUND",
-    "QUESTION",
-    "EMAIL",
-    "CHAT",
-    "SEARCH",
-    "CONNECT",
-    "FINANCE",
-    "SPORT",
-    "SHOP",
-    "ALTERASE",
-    "CANCEL",
-    "BRIGHTNESSDOWN",
-    "BRIGHTNESSUP",
-    "MEDIA",
-    "SWITCHVIDEOMODE",
-    "KBDILLUMTOGGLE",
-    "KBDILLUMDOWN",
-    "KBDILLUMUP",
-    "SEND",
-    "REPLY",
-    "FORWARDMAIL",
-    "SAVE",
-    "DOCUMENTS",
-    "BATTERY",
-    "BLUETOOTH",
-    "WLAN",
-    "UWB",
-    "UNKNOWN",
-    "VIDEO_NEXT",
-    "VIDEO_PREV",
-    "BRIGHTNESS_CYCLE",
-    "BRIGHTNESS_ZERO",
-    "DISPLAY_OFF",
-    "WWAN",
-    "WIMAX",
-    "RFKILL",
-    "MICMUTE",
-    "OK",
-    "SELECT",
-    "GOTO",
-    "CLEAR",
-    "POWER2",
-    "OPTION",
-    "INFO",
-    "TIME",
-    "VENDOR",
-    "ARCHIVE",
-    "PROGRAM",
-    "CHANNEL",
-    "FAVORITES",
-    "EPG",
-    "PVR",
-    "MHP",
-    "LANGUAGE",
-    "TITLE",
-    "SUBTITLE",
-    "ANGLE",
-    "ZOOM",
-    "MODE",
-    "KEYBOARD",
-    "SCREEN",
-    "PC",
-    "TV",
-    "TV2",
-    "VCR",
-    "VCR2",
-    "SAT",
-    "SAT2",
-    "CD",
-    "TAPE",
-    "RADIO",
-    "TUNER",
-    "PLAYER",
-    "TEXT",
-    "DVD",
-    "AUX",
-    "MP3",
-    "AUDIO",
-    "VIDEO",
-    "DIRECTORY",
-    "LIST",
-    "MEMO",
-    "CALENDAR",
-    "RED",
-    "GREEN",
-    "YELLOW",
-    "BLUE",
-    "CHANNELUP",
-    "CHANNELDOWN",
-    "FIRST",
-    "LAST",
-    "AB",
-    "NEXT",
-    "RESTART",
-    "SLOW",
-    "SHUFFLE",
-    "BREAK",
-    "PREVIOUS",
-    "DIGITS",
-    "TEEN",
-    "TWEN",
-    "VIDEOPHONE",
-    "GAMES",
-    "ZOOMIN",
-    "ZOOMOUT",
-    "ZOOMRESET",
-    "WORDPROCESSOR",
-    "EDITOR",
-    "SPREADSHEET",
-    "GRAPHICSEDITOR",
-    "PRESENTATION",
-    "DATABASE",
-    "NEWS",
-    "VOICEMAIL",
-    "ADDRESSBOOK",
-    "MESSENGER",
-    "DISPLAYTOGGLE",
-    "SPELLCHECK",
-    "LOGOFF",
-    "DOLLAR",
-    "EURO",
-    "FRAMEBACK",
-    "FRAMEFORWARD",
-    "CONTEXT_MENU",
-    "MEDIA_REPEAT",
-    "10CHANNELSUP",
-    "10CHANNELSDOWN",
-    "IMAGES",
-    "DEL_EOL",
-    "DEL_EOS",
-    "INS_LINE",
-    "DEL_LINE",
-    "FN",
-    "FN_ESC",
-    "FN_F1",
-    "FN_F2",
-    "FN_F3",
-    "FN_F4",
-    "FN_F5",
-    "FN_F6",
-    "FN_F7",
-    "FN_F8",
-    "FN_F9",
-    "FN_F10",
-    "FN_F11",
-    "FN_F12",
-    "FN_1",
-    "FN_2",
-    "FN_D",
-    "FN_E",
-    "FN_F",
-    "FN_S",
-    "FN_B",
-    "BRL_DOT1",
-    "BRL_DOT2",
-    "BRL_DOT3",
-    "BRL_DOT4",
-    "BRL_DOT5",
-    "BRL_DOT6",
-    "BRL_DOT7",
-    "BRL_DOT8",
-    "BRL_DOT9",
-    "BRL_DOT10",
-    "NUMERIC_0",
-    "NUMERIC_1",
-    "NUMERIC_2",
-    "NUMERIC_3",
-    "NUMERIC_4",
-    "NUMERIC_5",
-    "NUMERIC_6",
-    "NUMERIC_7",
-    "NUMERIC_8",
-    "NUMERIC_9",
-    "NUMERIC_STAR",
-    "NUMERIC_POUND",
-    "CAMERA_FOCUS",
-    "WPS_BUTTON",
-    "TOUCHPAD_TOGGLE",
-    "TOUCHPAD_ON",
-    "TOUCHPAD_OFF",
-    "CAMERA_ZOOMIN",
-    "CAMERA_ZOOMOUT",
-    "CAMERA_UP",
-    "CAMERA_DOWN",
-    "CAMERA_LEFT",
-    "CAMERA_RIGHT",
-    "ATTENDANT_ON",
-    "ATTENDANT_OFF",
-    "ATTENDANT_TOGGLE",
-    "LIGHTS_TOGGLE",
-    "ALS_TOGGLE",
-    "MIN_INTERESTING"
-};
-static const int KEYS[] = { KEY_ESC,
-	KEY_1,
-	KEY_2,
-	KEY_3,
-	KEY_4,
-	KEY_5,
-	KEY_6,
-	KEY_7,
-	KEY_8,
-	KEY_9,
-	KEY_0,
-	KEY_MINUS,
-	KEY_EQUAL,
-	KEY_BACKSPACE,
-	KEY_TAB,
-	KEY_Q,
-	KEY_W,
-	KEY_E,
-	KEY_R,
-	KEY_T,
-	KEY_Y,
-	KEY_U,
-	KEY_I,
-	KEY_O,
-	KEY_P,
-	KEY_LEFTBRACE,
-	KEY_RIGHTBRACE,
-	KEY_ENTER,
-	KEY_LEFTCTRL,
-	KEY_A,
-	KEY_S,
-	KEY_D,
-	KEY_F,
-	KEY_G,
-	KEY_H,
-	KEY_J,
-	KEY_K,
-	KEY_L,
-	KEY_SEMICOLON,
-	KEY_APOSTROPHE,
-	KEY_GRAVE,
-	KEY_LEFTSHIFT,
-	KEY_BACKSLASH,
-	KEY_Z,
-	KEY_X,
-	KEY_C,
-	KEY_V,
-	KEY_B,
-	KEY_N,
-	KEY_M,
-	KEY_COMMA,
-	KEY_DOT,
-	KEY_SLASH,
-	KEY_RIGHTSHIFT,
-	KEY_KPASTERISK,
-	KEY_LEFTALT,
-	KEY_SPACE,
-	KEY_CAPSLOCK,
-	KEY_F1,
-	KEY_F2,
-	KEY_F3,
-	KEY_F4,
-	KEY_F5,
-	KEY_F6,
-	KEY_F7,
-	KEY_F8,
-	KEY_F9,
-	KEY_F10,
-	KEY_NUMLOCK,
-	KEY_SCROLLLOCK,
-	KEY_KP7,
-	KEY_KP8,
-	KEY_KP9,
-	KEY_KPMINUS,
-	KEY_KP4,
-	KEY_KP5,
-	KEY_KP6,
-	KEY_KPPLUS,
-	KEY_KP1,
-	KEY_KP2,
-	KEY_KP3,
-	KEY_KP0,
-	KEY_KPDOT,
-	KEY_ZENKAKUHANKAKU,
-	KEY_102ND,
-	KEY_F11,
-	KEY_F12,
-	KEY_RO,
-	KEY_KATAKANA,
-	KEY_HIRAGANA,
-	KEY_HENKAN,
-	KEY_KATAKANAHIRAGANA,
-	KEY_MUHENKAN,
-	KEY_KPJPCOMMA,
-	KEY_KPENTER,
-	KEY_RIGHTCTRL,
-	KEY_KPSLASH,
-	KEY_SYSRQ,
-	KEY_RIGHTALT,
-	KEY_LINEFEED,
-	KEY_HOME,
-	KEY_UP,
-	KEY_PAGEUP,
-	KEY_LEFT,
-	KEY_RIGHT,
-	KEY_END,
-	KEY_DOWN,
-	KEY_PAGEDOWN,
-	KEY_INSERT,
-	KEY_DELETE,
-	KEY_MACRO,
-	KEY_MUTE,
-	KEY_VOLUMEDOWN,
-	KEY_VOLUMEUP,
-	KEY_POWER,
-	KEY_KPEQUAL,
-	KEY_KPPLUSMINUS,
-	KEY_PAUSE,
-	KEY_SCALE,
-	KEY_KPCOMMA,
-	KEY_HANGEUL,
-	KEY_HANGUEL,
-	KEY_HANJA,
-	KEY_YEN,
-	KEY_LEFTMETA,
-	KEY_RIGHTMETA,
-	KEY_COMPOSE,
-	KEY_STOP,
-	KEY_AGAIN,
-	KEY_PROPS,
-	KEY_UNDO,
-	KEY_FRONT,
-	KEY_COPY,
-	KEY_OPEN,
-	KEY_PASTE,
-	KEY_FIND,
-	KEY_CUT,
-	KEY_HELP,
-	KEY_MENU,
-	KEY_CALC,
-	KEY_SETUP,
-	KEY_SLEEP,
-	KEY_WAKEUP,
-	KEY_FILE,
-	KEY_SENDFILE,
-	KEY_DELETEFILE,
-	KEY_XFER,
-	KEY_PROG1,
-	KEY_PROG2,
-	KEY_WWW,
-	KEY_MSDOS,
-	KEY_COFFEE,
-	KEY_SCREENLOCK,
-	KEY_DIRECTION,
-	KEY_CYCLEWINDOWS,
-	KEY_MAIL,
-	KEY_BOOKMARKS,
-	KEY_COMPUTER,
-	KEY_BACK,
-	KEY_FORWARD,
-	KEY_CLOSECD,
-	KEY_EJECTCD,
-	KEY_EJECTCLOSECD,
-	KEY_NEXTSONG,
-	KEY_PLAYPAUSE,
-	KEY_PREVIOUSSONG,
-	KEY_STOPCD,
-	KEY_RECORD,
-	KEY_REWIND,
-	KEY_PHONE,
-	KEY_ISO,
-	KEY_CONFIG,
-	KEY_HOMEPAGE,
-	KEY_REFRESH,
-	KEY_EXIT,
-	KEY_MOVE,
-	KEY_EDIT,
-	KEY_SCROLLUP,
-	KEY_SCROLLDOWN,
-	KEY_KPLEFTPAREN,
-	KEY_KPRIGHTPAREN,
-	KEY_NEW,
-	KEY_REDO,
-	KEY_F13,
-	KEY_F14,
-	KEY_F15,
-	KEY_F16,
-	KEY_F17,
-	KEY_F18,
-	KEY_F19,
-	KEY_F20,
-	KEY_F21,
-	KEY_F22,
-	KEY_F23,
-	KEY_F24,
-	KEY_PLAYCD,
-	KEY_PAUSECD,
-	KEY_PROG3,
-	KEY_PROG4,
-	KEY_DASHBOARD,
-	KEY_SUSPEND,
-	KEY_CLOSE,
-	KEY_PLAY,
-	KEY_FASTFORWARD,
-	KEY_BASSBOOST,
-	KEY_PRINT,
-	KEY_HP,
-	KEY_CAMERA,
-	KEY_SOUND,
-	KEY_QUESTION,
-	KEY_EMAIL,
-	KEY_CHAT,
-	KEY_SEARCH,
-	KEY_CONNECT,
-	KEY_FINANCE,
-	KEY_SPORT,
-	KEY_SHOP,
-	KEY_ALTERASE,
-	KEY_CANCEL,
-	KEY_BRIGHTNESSDOWN,
-	KEY_BRIGHTNESSUP,
-	KEY_MEDIA,
-	KEY_SWITCHVIDEOMODE,
-	KEY_KBDILLUMTOGGLE,
-	KEY_KBDILLUMDOWN,
-	KEY_KBDILLUMUP,
-	KEY_SEND,
-	KEY_REPLY,
-	KEY_FORWARDMAIL,
-	KEY_SAVE,
-	KEY_DOCUMENTS,
-	KEY_BATTERY,
-	KEY_BLUETOOTH,
-	KEY_WLAN,
-	KEY_UWB,
-	KEY_UNKNOWN,
-	KEY_VIDEO_NEXT,
-	KEY_VIDEO_PREV,
-	KEY_BRIGHTNESS_CYCLE,
-	KEY_BRIGHTNESS_ZERO,
-	KEY_DISPLAY_OFF,
-	KEY_WWAN,
-	KEY_WIMAX,
-	KEY_RFKILL,
-	KEY_MICMUTE,
-	KEY_OK,
-	KEY_SELECT,
-	KEY_GOTO,
-	KEY_CLEAR,
-	KEY_POWER2,
-	KEY_OPTION,
-	KEY_INFO,
-	KEY_TIME,
-	KEY_VENDOR,
-	KEY_ARCHIVE,
-	KEY_PROGRAM,
-	KEY_CHANNEL,
-	KEY_FAVORITES,
-	KEY_EPG,
-	KEY_PVR,
-	KEY_MHP,
-	KEY_LANGUAGE,
-	KEY_TITLE,
-	KEY_SUBTITLE,
-	KEY_ANGLE,
-	KEY_ZOOM,
-	KEY_MODE,
-	KEY_KEYBOARD,
-	KEY_SCREEN,
-	KEY_PC,
-	KEY_TV,
-	KEY_TV2,
-	KEY_VCR,
-	KEY_VCR2,
-	KEY_SAT,
-	KEY_SAT2,
-	KEY_CD,
-	KEY_TAPE,
-	KEY_RADIO,
-	KEY_TUNER,
-	KEY_PLAYER,
-	KEY_TEXT,
-	KEY_DVD,
-	KEY_AUX,
-	KEY_MP3,
-	KEY_AUDIO,
-	KEY_VIDEO,
-	KEY_DIRECTORY,
-	KEY_LIST,
-	KEY_MEMO,
-	KEY_CALENDAR,
-	KEY_RED,
-	KEY_GREEN,
-	KEY_YELLOW,
-	KEY_BLUE,
-	KEY_CHANNELUP,
-	KEY_CHANNELDOWN,
-	KEY_FIRST,
-	KEY_LAST,
-	KEY_AB,
-	KEY_NEXT,
-	KEY_RESTART,
-	KEY_SLOW,
-	KEY_SHUFFLE,
-	KEY_BREAK,
-	KEY_PREVIOUS,
-	KEY_DIGITS,
-	KEY_TEEN,
-	KEY_TWEN,
-	KEY_VIDEOPHONE,
-	KEY_GAMES,
-	KEY_ZOOMIN,
-	KEY_ZOOMOUT,
-	KEY_ZOOMRESET,
-	KEY_WORDPROCESSOR,
-	KEY_EDITOR,
-	KEY_SPREADSHEET,
-	KEY_GRAPHICSEDITOR,
-	KEY_PRESENTATION,
-	KEY_DATABASE,
-	KEY_NEWS,
-	KEY_VOICEMAIL,
-	KEY_ADDRESSBOOK,
-	KEY_MESSENGER,
-	KEY_DISPLAYTOGGLE,
-	KEY_SPELLCHECK,
-	KEY_LOGOFF,
-	KEY_DOLLAR,
-	KEY_EURO,
-	KEY_FRAMEBACK,
-	KEY_FRAMEFORWARD,
-	KEY_CONTEXT_MENU,
-	KEY_MEDIA_REPEAT,
-	KEY_10CHANNELSUP,
-	KEY_10CHANNELSDOWN,
-	KEY_IMAGES,
-	KEY_DEL_EOL,
-	KEY_DEL_EOS,
-	KEY_INS_LINE,
-	KEY_DEL_LINE,
-	KEY_FN,
-	KEY_FN_ESC,
-	KEY_FN_F1,
-	KEY_FN_F2,
-	KEY_FN_F3,
-	KEY_FN_F4,
-	KEY_FN_F5,
-	KEY_FN_F6,
-	KEY_FN_F7,
-	KEY_FN_F8,
-	KEY_FN_F9,
-	KEY_FN_F10,
-	KEY_FN_F11,
-	KEY_FN_F12,
-	KEY_FN_1,
-	KEY_FN_2,
-	KEY_FN_D,
-	KEY_FN_E,
-	KEY_FN_F,
-	KEY_FN_S,
-	KEY_FN_B,
-	KEY_BRL_DOT1,
-	KEY_BRL_DOT2,
-	KEY_BRL_DOT3,
-	KEY_BRL_DOT4,
-	KEY_BRL_DOT5,
-	KEY_BRL_DOT6,
-	KEY_BRL_DOT7,
-	KEY_BRL_DOT8,
-	KEY_BRL_DOT9,
-	KEY_BRL_DOT10,
-	KEY_NUMERIC_0,
-	KEY_NUMERIC_1,
-	KEY_NUMERIC_2,
-	KEY_NUMERIC_3,
-	KEY_NUMERIC_4,
-	KEY_NUMERIC_5,
-	KEY_NUMERIC_6,
-	KEY_NUMERIC_7,
-	KEY_NUMERIC_8,
-	KEY_NUMERIC_9,
-	KEY_NUMERIC_STAR,
-	KEY_NUMERIC_POUND,
-	KEY_CAMERA_FOCUS,
-	KEY_WPS_BUTTON,
-	KEY_TOUCHPAD_TOGGLE,
-	KEY_TOUCHPAD_ON,
-	KEY_TOUCHPAD_OFF,
-	KEY_CAMERA_ZOOMIN,
-	KEY_CAMERA_ZOOMOUT,
-	KEY_CAMERA_UP,
-	KEY_CAMERA_DOWN,
-	KEY_CAMERA_LEFT,
-	KEY_CAMERA_RIGHT,
-	KEY_ATTENDANT_ON,
-	KEY_ATTENDANT_OFF,
-	KEY_ATTENDANT_TOGGLE,
-	KEY_LIGHTS_TOGGLE,
-	KEY_ALS_TOGGLE,
-	KEY_MIN_INTERESTING 
-};
-
-static void emit_event( int fd, int type, int code, int val )
+// The key tables are generated from linux/input-event-codes.h at build
+// time, by tools/gen_key_tables.c.
+#include "key_hash.h"
+#include "key_tables.h"
+
+void uinput_batch_init( uinput_batch_t * batch, int fd )
 {
-    struct input_event ev;
-    memset(&ev, 0, sizeof ev);
-    
-    ev.type = type;
-    ev.code = code;
-    ev.value = val;
-    
-    // Per documentation, timestamps are ignored.
-    ev.time.tv_sec = 0;
-    ev.time.tv_usec = 0;
-    
-    write( fd, &ev, sizeof ev );
+    memset( batch, 0, sizeof(uinput_batch_t) );
+    batch->fd = fd;
+}
+
+
+static void uinput_batch_add( uinput_batch_t * batch, int type, int code, int val )
+{
+    struct input_event * ev = &batch->events[ batch->length++ ];
+    memset( ev, 0, sizeof(struct input_event) );
+
+    ev->type = type;
+    ev->code = code;
+    ev->value = val;
+}
+
+
+/*
+ * Adds an event to the current frame, or starts a new frame if the
+ * same key (or axis) is already in it.
+ */
+static void uinput_batch_frame( uinput_batch_t * batch, int type, int code, int value )
+{
+    // Leave room for the event, a SYN_REPORT that may start a new
+    // frame and the one that ends the last frame.
+    if (batch->length + 3 > UINPUT_BATCH_MAX)
+    {
+        uinput_batch_flush( batch );
+    }
+
+    for(int i=batch->frame; i<batch->length; i++)
+    {
+        if (batch->events[i].type == type && batch->events[i].code == code)
+        {
+            uinput_batch_add( batch, EV_SYN, SYN_REPORT, 0 );
+            batch->frame = batch->length;
+            break;
+        }
+    }
+
+    uinput_batch_add( batch, type, code, value );
+}
+
+
+/*
+ * Adds a key press or release to the current frame.
+ */
+void uinput_batch_key( uinput_batch_t * batch, int code, int press )
+{
+    unsigned char * dropped = &batch->dropped_keys[ code / 8 ];
+    const unsigned char bit = 1 << (code % 8);
+
+    // Its press never made it, so neither does the release.
+    if (!press && (*dropped & bit))
+    {
+        *dropped &= ~bit;
+        batch->drops++;
+        return;
+    }
+
+    uinput_batch_frame( batch, EV_KEY, code, press );
+}
+
+
+/*
+ * Adds the (already encoded) key events of an action to the current
+ * frame. They are copied in one go, unless one of their keys is in the
+ * frame already or had its press dropped, which they are added like
+ * `uinput_batch_key()` for.
+ */
+void uinput_batch_keys( uinput_batch_t * batch, const struct input_event * events, int count )
+{
+    int copy = batch->length + count + 2 <= UINPUT_BATCH_MAX;
+
+    for(int i=0; i<count && copy; i++)
+    {
+        const int code = events[i].code;
+
+        if (batch->dropped_keys[ code / 8 ] & (1 << (code % 8))) copy = 0;
+
+        for(int j=batch->frame; j<batch->length && copy; j++)
+        {
+            if (batch->events[j].type == EV_KEY && batch->events[j].code == code) copy = 0;
+        }
+
+        for(int j=0; j<i && copy; j++)
+        {
+            if (events[j].code == code) copy = 0;
+        }
+    }
+
+    if (!copy)
+    {
+        for(int i=0; i<count; i++)
+        {
+            uinput_batch_key( batch, events[i].code, events[i].value );
+        }
+
+        return;
+    }
+
+    memcpy( &batch->events[ batch->length ], events, count * sizeof(struct input_event) );
+    batch->length += count;
+}
+
+
+/*
+ * Adds a relative axis movement, like the key presses above.
+ */
+void uinput_batch_rel( uinput_batch_t * batch, int code, int value )
+{
+    uinput_batch_frame( batch, EV_REL, code, value );
+}
+
+
+/*
+ * Queues an event the device didn't take. A press (or an axis movement)
+ * is dropped when the queue is a quarter full, and anything once it is
+ * full.
+ */
+static void uinput_pending_add( uinput_batch_t * batch, const struct input_event * event )
+{
+    const int is_press = event->type == EV_KEY && event->value != 0;
+    const int is_optional = is_press || event->type == EV_REL;
+    unsigned char * dropped = &batch->dropped_keys[ event->code / 8 ];
+    const unsigned char bit = 1 << (event->code % 8);
+
+    // A release in the same batch as its dropped press.
+    if (event->type == EV_KEY && !is_press && (*dropped & bit))
+    {
+        *dropped &= ~bit;
+        batch->drops++;
+        return;
+    }
+
+    const unsigned int tail = (batch->pending_head + batch->pending_length) & (UINPUT_PENDING_SZ - 1);
+    const unsigned int last = (tail - 1) & (UINPUT_PENDING_SZ - 1);
+
+    // No need for a frame without keys, when all of it was dropped.
+    if (event->type == EV_SYN && batch->pending_length > 0
+        && batch->pending[ last ].type == EV_SYN)
+    {
+        return;
+    }
+
+    if (batch->pending_length == UINPUT_PENDING_SZ
+        || (is_optional && batch->pending_length >= UINPUT_PENDING_SZ / 4))
+    {
+        if (event->type == EV_SYN) return;
+
+        if (is_press) *dropped |= bit;
+        batch->drops++;
+        return;
+    }
+
+    batch->pending[ tail ] = *event;
+    batch->pending_length++;
+}
+
+
+/*
+ * Writes as much of the pending events as the device takes.
+ */
+static void uinput_pending_write( uinput_batch_t * batch )
+{
+    while (batch->pending_length > 0)
+    {
+        // The part up to the end of the ring, the rest goes next round.
+        unsigned int count = UINPUT_PENDING_SZ - batch->pending_head;
+        if (count > batch->pending_length) count = batch->pending_length;
+
+        batch->retries++;
+
+        const size_t size = count * sizeof(struct input_event) - batch->pending_offset;
+        const ssize_t result = write( batch->fd,
+            (char *)&batch->pending[ batch->pending_head ] + batch->pending_offset, size );
+        if (result <= 0) return;
+
+        const size_t bytes = batch->pending_offset + result;
+        const unsigned int written = bytes / sizeof(struct input_event);
+
+        batch->pending_offset = bytes % sizeof(struct input_event);
+        batch->pending_head = (batch->pending_head + written) & (UINPUT_PENDING_SZ - 1);
+        batch->pending_length -= written;
+
+        if (result < size) return;
+    }
 }
 
-static void emit_report( int fd )
+
+/*
+ * Ends the current frame and writes all of it. Whatever the device
+ * doesn't take (EAGAIN) is kept for `uinput_batch_retry()`.
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+int uinput_batch_flush( uinput_batch_t * batch )
 {
-    emit_event( fd, EV_SYN, SYN_REPORT, 0 );
+    if (batch->length == 0) return 0;
+
+    uinput_batch_add( batch, EV_SYN, SYN_REPORT, 0 );
+
+    int written = 0;
+    int result = 0;
+
+    // Only write it directly if nothing is waiting before it.
+    if (batch->pending_length == 0)
+    {
+        const ssize_t size = batch->length * sizeof(struct input_event);
+        const ssize_t count = write( batch->fd, batch->events, size );
+
+        if (count == size)
+        {
+            batch->length = 0;
+            batch->frame = 0;
+
+            LATENCY_END( LATENCY_UINPUT );
+            return 0;
+        }
+
+        if (count > 0) written = count / sizeof(struct input_event);
+        else if (errno != EAGAIN && errno != EINTR) result = -1;
+
+        // What is left of an event that was partly written has
+        // to go out first, whatever else is dropped.
+        if (count > 0 && count % sizeof(struct input_event))
+        {
+            batch->pending[ batch->pending_head ] = batch->events[ written++ ];
+            batch->pending_length = 1;
+            batch->pending_offset = count % sizeof(struct input_event);
+        }
+    }
+
+    if (result == 0)
+    {
+        for(int i=written; i<batch->length; i++)
+        {
+            uinput_pending_add( batch, &batch->events[i] );
+        }
+
+        uinput_pending_write( batch );
+    }
+
+    batch->length = 0;
+    batch->frame = 0;
+
+    return result;
 }
 
-void key_press( int fd, int code )
+
+/*
+ * Writes the pending events again, for when the device is writable.
+ *
+ * Returns the number of events that are still pending.
+ */
+int uinput_batch_retry( uinput_batch_t * batch )
 {
-    emit_event( fd, EV_KEY, code, 1 );
-    emit_report( fd );
+    uinput_pending_write( batch );
+    return batch->pending_length;
 }
 
-void key_release( int fd, int code )
+
+int uinput_batch_pending( const uinput_batch_t * batch )
 {
-    emit_event( fd, EV_KEY, code, 0 );
-    emit_report( fd );
+    return batch->pending_length;
 }
 
+
 int uinput_open(char*path)
 {
     struct uinput_setup usetup;
@@ -855,11 +290,13 @@ int uinput_open(char*path)
         
         // Set up all possible key down events.
         ioctl( fd, UI_SET_EVBIT, EV_KEY);
-        for(int key=0; key<MAX_KEYS; key++)
+        for(int key=0; key<KEY_TABLE_CODES; key++)
 		{
-			if(ioctl(fd, UI_SET_KEYBIT, KEYS[key] ) < 0)
+			if (KEY_NAMES[key] == NULL) continue;
+
+			if(ioctl(fd, UI_SET_KEYBIT, key ) < 0)
 			{
-				printf( "ioctl(UI_SET_KEYBIT) failed %d, %d\n", key, KEYS[key] );
+				printf( "ioctl(UI_SET_KEYBIT) failed %d, %s\n", key, KEY_NAMES[key] );
 			}
 		}
         
@@ -870,6 +307,50 @@ int uinput_open(char*path)
     return fd;
 }
 
+/*
+ * Opens a second device for the wheels, so the dial can scroll. It is
+ * set up as a mouse (with buttons and X/Y that are never sent), as a
+ * device with only wheels isn't picked up as a pointer by udev and
+ * libinput.
+ */
+int uinput_open_rel(char*path)
+{
+    struct uinput_setup usetup;
+    static const int buttons[] = { BTN_LEFT, BTN_RIGHT, BTN_MIDDLE };
+    static const int axes[] = { REL_X, REL_Y, REL_WHEEL, REL_HWHEEL, REL_WHEEL_HI_RES, REL_HWHEEL_HI_RES };
+
+    int fd = open( path,  O_WRONLY | O_NONBLOCK );
+    if (fd > 0)
+    {
+        memset( &usetup, 0, sizeof usetup );
+
+        usetup.id.bustype = BUS_USB;
+        usetup.id.vendor = 0x1234;
+        usetup.id.product = 0x5679;
+        strcpy( usetup.name, "Kontroller Wheel" );
+
+        ioctl( fd, UI_SET_EVBIT, EV_KEY );
+        for(int i=0; i<sizeof buttons / sizeof buttons[0]; i++)
+        {
+            ioctl( fd, UI_SET_KEYBIT, buttons[i] );
+        }
+
+        ioctl( fd, UI_SET_EVBIT, EV_REL );
+        for(int i=0; i<sizeof axes / sizeof axes[0]; i++)
+        {
+            if (ioctl( fd, UI_SET_RELBIT, axes[i] ) < 0)
+            {
+                printf( "ioctl(UI_SET_RELBIT) failed %d\n", axes[i] );
+            }
+        }
+
+        ioctl( fd, UI_DEV_SETUP, &usetup );
+        ioctl( fd, UI_DEV_CREATE );
+    }
+
+    return fd;
+}
+
 void uinput_close( int fd )
 {
     ioctl(fd, UI_DEV_DESTROY);
@@ -885,13 +366,15 @@ void uinput_close( int fd )
  */
 int key_parse( char * keyname )
 {
-    //size_t length = strlen(keyname);
-    for(int i=0; i<MAX_KEYS; i++)
+    // The name can only be in the one slot its bucket's
+    // displacement points at.
+    const int bucket = key_hash( keyname, 0 ) & (KEY_TABLE_BUCKETS-1);
+    const int slot = key_hash( keyname, KEY_DISPLACEMENTS[ bucket ] ) & (KEY_TABLE_SIZE-1);
+
+    const key_entry_t * entry = &KEY_TABLE[ slot ];
+    if (entry->name != NULL && strcasecmp( keyname, entry->name ) == 0)
     {
-        if (strcasecmp( keyname, KEY_STRINGS[i] ) == 0)
-        {
-            return KEYS[ i ];
-        }
+        return entry->code;
     }
     
     return -1;
@@ -899,11 +382,36 @@ int key_parse( char * keyname )
 
 const char * key_name( int code )
 {
-    for(int i=0; i<MAX_KEYS; i++)
+    if (code >= 0 && code < KEY_TABLE_CODES && KEY_NAMES[ code ] != NULL)
     {
-        if (KEYS[i] == code)
-            return KEY_STRINGS[i];
+        return KEY_NAMES[ code ];
     }
     
     return INVALID_KEY_OR_BUTTON;
 }
+
+
+/**
+ * This converts the name of a wheel ("Wheel" or "HWheel") to the
+ * constant REL_WHEEL or REL_HWHEEL.
+ *
+ * This returns -1 if it cannot be parsed.
+ */
+int rel_parse( char * relname )
+{
+    if (strcasecmp( relname, "Wheel" ) == 0) return REL_WHEEL;
+    if (strcasecmp( relname, "HWheel" ) == 0) return REL_HWHEEL;
+
+    return -1;
+}
+
+const char * rel_name( int code )
+{
+    switch (code)
+    {
+        case REL_WHEEL: return "Wheel";
+        case REL_HWHEEL: return "HWheel";
+    }
+
+    return INVALID_KEY_OR_BUTTON;
+}
@@ -3,21 +3,73 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #include <linux/uinput.h>
 
 #include "defs.h"
+#include "latency.h"
 
 #ifndef _UINPUT_STUFF_H_
 #define _UINPUT_STUFF_H_
 
+// The most events (SYN_REPORTs included) that are written at once.
+#define UINPUT_BATCH_MAX    64
+
+// The most events that wait for the device to take them (after an
+// EAGAIN), must be a power of two. Presses are only queued while less
+// than a quarter of it is used, so there is always room for their
+// releases (and SYN_REPORTs).
+#define UINPUT_PENDING_SZ   512
+
+/*
+ * Collects the key events of a report, so they can be written with a
+ * single `write()`. A chord ends up in a single frame (one SYN_REPORT),
+ * a key that changes twice (a dial press and release) gets a frame for
+ * each change.
+ */
+typedef struct uinput_batch_t {
+    int fd;
+    int length;
+
+    // Where the frame that is being built starts.
+    int frame;
+
+    struct input_event events[ UINPUT_BATCH_MAX ];
+
+    // What the device didn't take yet, oldest first. Once anything is
+    // pending, later frames queue up behind it to stay in order.
+    unsigned int pending_head;
+    unsigned int pending_length;
+    struct input_event pending[ UINPUT_PENDING_SZ ];
+
+    // The bytes of the oldest pending event that were written already,
+    // a pipe may take less than a whole event.
+    unsigned int pending_offset;
+
+    // The keys whose press was dropped, their release is dropped too.
+    unsigned char dropped_keys[ KEY_MAX / 8 + 1 ];
+
+    unsigned long retries;  // writes of pending events
+    unsigned long drops;    // key (and axis) events that were dropped
+} uinput_batch_t;
+
 int uinput_open(char *path);
+int uinput_open_rel(char *path);
 void uinput_close();
 
-void key_press( int fd, int code );
-void key_release( int fd, int code );
+void uinput_batch_init( uinput_batch_t * batch, int fd );
+void uinput_batch_key( uinput_batch_t * batch, int code, int press );
+void uinput_batch_keys( uinput_batch_t * batch, const struct input_event * events, int count );
+void uinput_batch_rel( uinput_batch_t * batch, int code, int value );
+int uinput_batch_flush( uinput_batch_t * batch );
+int uinput_batch_retry( uinput_batch_t * batch );
+int uinput_batch_pending( const uinput_batch_t * batch );
 
 int key_parse( char * );
 const char * key_name( int code );
 
+int rel_parse( char * );
+const char * rel_name( int code );
+
 #endif /* _UINPUT_STUFF_H_ */
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "key_hash.h"
+
+/*
+ * Generates the key tables of `uinput_stuff.c` from the `KEY_*` defines
+ * in `linux/input-event-codes.h`, so they follow whatever the kernel
+ * headers have:
+ *
+ * - a perfect hash table for the name to code lookup, using "hash and
+ *   displace": a name is put in a bucket with `key_hash( name, 0 )`, and
+ *   every bucket gets a displacement (the seed of the second hash) that
+ *   puts all its names in a free slot;
+ * - a table indexed by the code for the code to name lookup.
+ *
+ * Usage: gen_key_tables /usr/include/linux/input-event-codes.h > key_tables.h
+ */
+
+#define GEN_MAX_KEYS        2048
+#define GEN_NAME_SZ         64
+#define GEN_MAX_DISPLACEMENT 65535
+
+typedef struct gen_key_t {
+    char name[ GEN_NAME_SZ ];   // without the "KEY_"
+    int code;
+    int bucket;
+} gen_key_t;
+
+static gen_key_t keys[ GEN_MAX_KEYS ];
+static int key_count = 0;
+
+
+static int gen_find( const char * name )
+{
+    for(int i=0; i<key_count; i++)
+    {
+        if (strcmp( keys[i].name, name ) == 0) return i;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Reads all the `#define KEY_<name> <value>` lines, where the value is
+ * a number or another KEY_ define (an alias).
+ *
+ * Returns -1 on error, 0 if all is well.
+ */
+static int gen_read( const char * path )
+{
+    char line[ 256 ];
+    char define[ GEN_NAME_SZ ];
+    char value[ GEN_NAME_SZ ];
+
+    FILE * file = fopen( path, "r" );
+    if (!file)
+    {
+        perror( path );
+        return -1;
+    }
+
+    while (fgets( line, sizeof line, file ))
+    {
+        if (sscanf( line, " #define KEY_%63s %63s", define, value ) != 2) continue;
+
+        // Not actual keys.
+        if (strcmp( define, "RESERVED" ) == 0
+            || strcmp( define, "MAX" ) == 0
+            || strcmp( define, "CNT" ) == 0)
+        {
+            continue;
+        }
+
+        // Defined more than once, for different kernel versions.
+        if (gen_find( define ) >= 0) continue;
+
+        int code;
+        if (strncmp( value, "KEY_", 4 ) == 0)
+        {
+            const int alias = gen_find( value + 4 );
+            if (alias < 0)
+            {
+                printf( "%s: %s is not defined before KEY_%s\n", path, value, define );
+                fclose( file );
+                return -1;
+            }
+
+            code = keys[ alias ].code;
+        }
+        else
+        {
+            char * end;
+            code = strtol( value, &end, 0 );
+            if (*end != 0) continue;
+        }
+
+        if (key_count == GEN_MAX_KEYS)
+        {
+            printf( "%s: too many keys\n", path );
+            fclose( file );
+            return -1;
+        }
+
+        strcpy( keys[ key_count ].name, define );
+        keys[ key_count ].code = code;
+        key_count++;
+    }
+
+    fclose( file );
+
+    if (key_count == 0)
+    {
+        printf( "%s: no KEY_ defines found\n", path );
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Finds a displacement for every bucket, the largest buckets first as
+ * those are the hardest to place.
+ *
+ * Returns -1 if that didn't work out for this table size, 0 if all is well.
+ */
+static int gen_place( int size, int buckets, int * displacements, int * slots )
+{
+    int * bucket_size = calloc( buckets, sizeof(int) );
+    int * placed = calloc( buckets, sizeof(int) );
+    int result = 0;
+
+    for(int i=0; i<size; i++) slots[i] = -1;
+
+    for(int i=0; i<key_count; i++)
+    {
+        keys[i].bucket = key_hash( keys[i].name, 0 ) & (buckets-1);
+        bucket_size[ keys[i].bucket ]++;
+    }
+
+    for(int round=0; round<buckets; round++)
+    {
+        // The largest bucket that hasn't been placed yet.
+        int bucket = -1;
+        for(int b=0; b<buckets; b++)
+        {
+            if (!placed[b] && (bucket < 0 || bucket_size[b] > bucket_size[bucket])) bucket = b;
+        }
+
+        placed[ bucket ] = 1;
+        displacements[ bucket ] = 0;
+        if (bucket_size[ bucket ] == 0) continue;
+
+        int displacement;
+        for(displacement=1; displacement<=GEN_MAX_DISPLACEMENT; displacement++)
+        {
+            int ok = 1;
+            int i;
+
+            for(i=0; i<key_count && ok; i++)
+            {
+                if (keys[i].bucket != bucket) continue;
+
+                const int slot = key_hash( keys[i].name, displacement ) & (size-1);
+                if (slots[ slot ] >= 0) ok = 0;
+                else slots[ slot ] = i;
+            }
+
+            if (ok) break;
+
+            // Undo what was placed of this bucket.
+            for(int j=0; j<i; j++)
+            {
+                if (keys[j].bucket != bucket) continue;
+
+                const int slot = key_hash( keys[j].name, displacement ) & (size-1);
+                if (slots[ slot ] == j) slots[ slot ] = -1;
+            }
+        }
+
+        if (displacement > GEN_MAX_DISPLACEMENT)
+        {
+            result = -1;
+            break;
+        }
+
+        displacements[ bucket ] = displacement;
+    }
+
+    free( bucket_size );
+    free( placed );
+    return result;
+}
+
+
+int main( int argc, char ** argv )
+{
+    if (argc != 2)
+    {
+        printf( "Usage: %s <input-event-codes.h>\n", argv[0] );
+        return 1;
+    }
+
+    if (gen_read( argv[1] ) < 0) return 1;
+
+    // Start with the smallest table that fits, with a bucket per four
+    // keys, and make it larger if the keys can't be placed.
+    int size = 1;
+    while (size < key_count) size <<= 1;
+
+    int buckets = 1;
+    while (buckets * 4 < key_count) buckets <<= 1;
+
+    int * displacements = NULL;
+    int * slots = NULL;
+    for(;;)
+    {
+        displacements = realloc( displacements, buckets * sizeof(int) );
+        slots = realloc( slots, size * sizeof(int) );
+
+        if (gen_place( size, buckets, displacements, slots ) == 0) break;
+
+        size <<= 1;
+    }
+
+    int max_code = 0;
+    for(int i=0; i<key_count; i++)
+    {
+        if (keys[i].code > max_code) max_code = keys[i].code;
+    }
+
+    printf( "/* Generated by gen_key_tables from %s, do not edit. */\n\n", argv[1] );
+
+    printf( "#define KEY_TABLE_SIZE      %d\n", size );
+    printf( "#define KEY_TABLE_BUCKETS   %d\n", buckets );
+    printf( "#define KEY_TABLE_CODES     %d\n\n", max_code + 1 );
+
+    printf( "static const uint16_t KEY_DISPLACEMENTS[ KEY_TABLE_BUCKETS ] = {\n" );
+    for(int b=0; b<buckets; b++)
+    {
+        printf( "%s%d,%s", b % 16 == 0 ? "    " : " ", displacements[b], b % 16 == 15 ? "\n" : "" );
+    }
+    printf( "%s};\n\n", buckets % 16 ? "\n" : "" );
+
+    printf( "static const key_entry_t KEY_TABLE[ KEY_TABLE_SIZE ] = {\n" );
+    for(int slot=0; slot<size; slot++)
+    {
+        if (slots[ slot ] < 0) continue;
+
+        const gen_key_t * key = &keys[ slots[ slot ] ];
+        printf( "    [%d] = { \"%s\", %d },\n", slot, key->name, key->code );
+    }
+    printf( "};\n\n" );
+
+    // An alias comes after the key it refers to, so the first name
+    // of a code is the one it is known by.
+    printf( "static const char * const KEY_NAMES[ KEY_TABLE_CODES ] = {\n" );
+    for(int i=0; i<key_count; i++)
+    {
+        int first = 1;
+        for(int j=0; j<i; j++)
+        {
+            if (keys[j].code == keys[i].code) first = 0;
+        }
+
+        if (first) printf( "    [%d] = \"%s\",\n", keys[i].code, keys[i].name );
+    }
+    printf( "};\n" );
+
+    free( displacements );
+    free( slots );
+    return 0;
+}